@@ -4,6 +4,8 @@
 static const unsigned int snap      = 6;  /* snap pixel */
 static const int lockfullscreen     = 1;  /* 1 will force focus on the fullscreen window */
 static const int focusedontop       = 0;  /* 1 means focused client is shown on top of floating windows */
+static const unsigned int batchsize = 64; /* events handled before arranging, 1 means arrange after every event */
+static const int barfps             = 0;  /* bar repaints per second at most, 0 follows the monitor refresh rate, -1 paints at once */
 /* appearance */
 static const unsigned int borderpx  = 1;  /* border pixel of windows */
 static const unsigned int barborder = 3;  /* border pixel of bar */
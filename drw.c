@@ -10,12 +10,53 @@
 
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ     4
+#define WIDTHCACHE  256 /* measured strings remembered, a power of two */
+#define COVERAGE    1024 /* codepoints remembered, a power of two */
+#define FALLBACKS   8    /* fallback fonts kept open */
+#define NOMATCHES   64   /* codepoints remembered as missing from all fonts */
+#define SPRITES     64   /* pre-rendered strings kept, a power of two */
 
 static const unsigned char utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const unsigned char utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
 static const long utfmin[UTF_SIZ + 1] = {       0,    0,  0x80,  0x800,  0x10000};
 static const long utfmax[UTF_SIZ + 1] = {0x10FFFF, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF};
 
+/* direct-mapped cache of drw_fontset_getwidth() results */
+static struct {
+	Fnt *set;
+	char *text;
+	unsigned int w;
+} widths[WIDTHCACHE];
+
+/* strings drw_sprite() rendered before, as server-side pixmaps */
+static struct {
+	Fnt *set;
+	char *text;
+	unsigned long fg, bg;
+	unsigned int w, h, lpad;
+	int invert;
+	Pixmap pixmap;
+} sprites[SPRITES];
+
+/* which font of a fontset draws a codepoint, so drw_text() only asks Xft
+ * about characters it has not seen before, and the fallback fonts found
+ * for the set, kept apart from it and closed least recently used first */
+static struct {
+	Fnt *set;
+	unsigned char asciiknown[16], asciihas[16]; /* first font only */
+	struct {
+		long cp;
+		Fnt *font; /* NULL for a free slot */
+	} map[COVERAGE];
+	unsigned int n;
+	Fnt *fallback[FALLBACKS];
+	unsigned int nfallback;
+	long nomatch[NOMATCHES]; /* ring of codepoints no font has */
+	unsigned int nomatchidx;
+	unsigned long tick;
+} coverage;
+
+
 static long
 utf8decodebyte(const char c, size_t *i)
 {
@@ -71,6 +112,9 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->w = w;
 	drw->h = h;
 	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
+	drw->xftdraw = XftDrawCreate(dpy, drw->drawable,
+	                             DefaultVisual(dpy, screen),
+	                             DefaultColormap(dpy, screen));
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
 
@@ -85,17 +129,22 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 
 	drw->w = w;
 	drw->h = h;
+	if (drw->xftdraw)
+		XftDrawDestroy(drw->xftdraw);
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	drw->xftdraw = XftDrawCreate(drw->dpy, drw->drawable,
+	                             DefaultVisual(drw->dpy, drw->screen),
+	                             DefaultColormap(drw->dpy, drw->screen));
 }
 
 void
 drw_free(Drw *drw)
 {
+	XftDrawDestroy(drw->xftdraw);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
-	drw_fontset_free(drw->fonts);
 	free(drw);
 }
 
@@ -166,6 +215,127 @@ xfont_free(Fnt *font)
 	free(font);
 }
 
+static void
+resetcoverage(Fnt *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < coverage.nfallback; i++)
+		xfont_free(coverage.fallback[i]);
+	memset(&coverage, 0, sizeof coverage);
+	coverage.set = set;
+}
+
+static int
+ismissing(long cp)
+{
+	unsigned int i;
+
+	for (i = 0; i < NOMATCHES; i++)
+		if (coverage.nomatch[i] == cp)
+			return 1;
+	return 0;
+}
+
+static void
+addmissing(long cp)
+{
+	coverage.nomatch[coverage.nomatchidx++ % NOMATCHES] = cp;
+}
+
+static void
+addfallback(Fnt *font)
+{
+	unsigned int i, lru = 0;
+
+	font->used = ++coverage.tick;
+	if (coverage.nfallback < FALLBACKS) {
+		coverage.fallback[coverage.nfallback++] = font;
+		return;
+	}
+	for (i = 1; i < FALLBACKS; i++)
+		if (coverage.fallback[i]->used < coverage.fallback[lru]->used)
+			lru = i;
+	xfont_free(coverage.fallback[lru]);
+	coverage.fallback[lru] = font;
+	/* forget what the closed font used to draw */
+	memset(coverage.map, 0, sizeof coverage.map);
+	coverage.n = 0;
+}
+
+static Fnt *
+fontforchar(Drw *drw, long cp)
+{
+	Fnt *font;
+	unsigned int i, j, mask = COVERAGE - 1;
+
+	if (coverage.set != drw->fonts)
+		resetcoverage(drw->fonts);
+	if (cp >= 0 && cp < 128) {
+		if (!(coverage.asciiknown[cp / 8] & 1 << cp % 8)) {
+			coverage.asciiknown[cp / 8] |= 1 << cp % 8;
+			if (XftCharExists(drw->dpy, drw->fonts->xfont, cp))
+				coverage.asciihas[cp / 8] |= 1 << cp % 8;
+		}
+		if (coverage.asciihas[cp / 8] & 1 << cp % 8)
+			return drw->fonts;
+	}
+	for (i = (cp * 2654435761u) & mask; coverage.map[i].font; i = (i + 1) & mask)
+		if (coverage.map[i].cp == cp) {
+			coverage.map[i].font->used = ++coverage.tick;
+			return coverage.map[i].font;
+		}
+	if (ismissing(cp))
+		return NULL;
+
+	for (font = drw->fonts; font; font = font->next)
+		if (XftCharExists(drw->dpy, font->xfont, cp))
+			break;
+	for (j = 0; !font && j < coverage.nfallback; j++)
+		if (XftCharExists(drw->dpy, coverage.fallback[j]->xfont, cp))
+			font = coverage.fallback[j];
+	/* only hits go in the map, a missing codepoint may still get a
+	 * fallback font */
+	if (!font)
+		return NULL;
+	if (coverage.n >= COVERAGE / 2) {
+		memset(coverage.map, 0, sizeof coverage.map);
+		coverage.n = 0;
+		for (i = (cp * 2654435761u) & mask; coverage.map[i].font; i = (i + 1) & mask);
+	}
+	coverage.map[i].cp = cp;
+	coverage.map[i].font = font;
+	coverage.n++;
+	font->used = ++coverage.tick;
+	return font;
+}
+
+/* Length of the longest prefix of text no wider than w. It only ends on
+ * character boundaries and is found by bisection, so a long title costs a
+ * handful of extents requests instead of one per byte. */
+static size_t
+fitprefix(Fnt *font, const char *text, size_t len, unsigned int w)
+{
+	unsigned short cut[1024]; /* cut[n] ends the first n + 1 characters */
+	size_t i, n = 0, lo = 0, hi, mid;
+	unsigned int ew;
+
+	len = MIN(len, sizeof(cut) / sizeof(cut[0]));
+	/* text[len] is readable, it is the next character or the end */
+	for (i = 1; i <= len; i++)
+		if (((unsigned char)text[i] & 0xC0) != 0x80)
+			cut[n++] = i;
+	for (hi = n; lo < hi;) {
+		mid = (lo + hi + 1) / 2;
+		drw_font_getexts(font, text, cut[mid - 1], &ew, NULL);
+		if (ew <= w)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo ? cut[lo - 1] : 0;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -187,7 +357,24 @@ drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 void
 drw_fontset_free(Fnt *font)
 {
+	size_t i;
+
 	if (font) {
+		if (coverage.set == font)
+			resetcoverage(NULL);
+		for (i = 0; i < WIDTHCACHE; i++)
+			if (widths[i].set == font) {
+				free(widths[i].text);
+				widths[i].text = NULL;
+				widths[i].set = NULL;
+			}
+		for (i = 0; i < SPRITES; i++)
+			if (sprites[i].set == font) {
+				XFreePixmap(font->dpy, sprites[i].pixmap);
+				free(sprites[i].text);
+				sprites[i].text = NULL;
+				sprites[i].set = NULL;
+			}
 		drw_fontset_free(font->next);
 		xfont_free(font);
 	}
@@ -254,10 +441,9 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 {
 	char buf[1024];
 	int ty;
-	unsigned int ew;
-	XftDraw *d = NULL;
+	unsigned int ew, ellipsisw;
 	Fnt *usedfont, *curfont, *nextfont;
-	size_t i, len;
+	size_t len;
 	int utf8strlen, utf8charlen, render = x || y || w || h;
 	long utf8codepoint = 0;
 	const char *utf8str;
@@ -267,6 +453,7 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	XftResult result;
 	int charexists = 0;
 
+	PROBE5(drw_text, x, y, w, h, text);
 	if (!drw || (render && !drw->scheme) || !text || !drw->fonts)
 		return 0;
 
@@ -275,9 +462,6 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	} else {
 		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-		                  DefaultVisual(drw->dpy, drw->screen),
-		                  DefaultColormap(drw->dpy, drw->screen));
 		x += lpad;
 		w -= lpad;
 	}
@@ -289,41 +473,43 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 		nextfont = NULL;
 		while (*text) {
 			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-					} else {
-						nextfont = curfont;
-					}
+			if (!(curfont = fontforchar(drw, utf8codepoint))) {
+				if (!charexists)
 					break;
-				}
+				/* no fallback either, draw it with the first font */
+				curfont = drw->fonts;
 			}
-
-			if (!charexists || nextfont)
+			if (curfont != usedfont) {
+				nextfont = curfont;
 				break;
-			else
-				charexists = 0;
+			}
+			charexists = 0;
+			utf8strlen += utf8charlen;
+			text += utf8charlen;
 		}
 
 		if (utf8strlen) {
 			drw_font_getexts(usedfont, utf8str, utf8strlen, &ew, NULL);
-			/* shorten text if necessary */
-			for (len = MIN(utf8strlen, sizeof(buf) - 1); len && ew > w; len--)
-				drw_font_getexts(usedfont, utf8str, len, &ew, NULL);
+			/* shorten text if necessary, leaving room for an ellipsis */
+			len = MIN(utf8strlen, sizeof(buf) - 4);
+			if (ew > w || len < utf8strlen) {
+				drw_font_getexts(usedfont, "...", 3, &ellipsisw, NULL);
+				len = ellipsisw < w
+					? fitprefix(usedfont, utf8str, len, w - ellipsisw) : 0;
+			}
 
 			if (len) {
 				memcpy(buf, utf8str, len);
+				if (len < utf8strlen) {
+					memcpy(buf + len, "...", 3);
+					len += 3;
+					drw_font_getexts(usedfont, buf, len, &ew, NULL);
+				}
 				buf[len] = '\0';
-				if (len < utf8strlen)
-					for (i = len; i && i > len - 3; buf[--i] = '.')
-						; /* NOP */
 
 				if (render) {
 					ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
+					XftDrawStringUtf8(drw->xftdraw, &drw->scheme[invert ? ColBg : ColFg],
 					                  usedfont->xfont, x, ty, (XftChar8 *)buf, len);
 				}
 				x += ew;
@@ -340,6 +526,9 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 			/* Regardless of whether or not a fallback font is found, the
 			 * character must be drawn. */
 			charexists = 1;
+			usedfont = drw->fonts;
+			if (ismissing(utf8codepoint))
+				continue;
 
 			fccharset = FcCharSetCreate();
 			FcCharSetAddChar(fccharset, utf8codepoint);
@@ -361,25 +550,70 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 			FcCharSetDestroy(fccharset);
 			FcPatternDestroy(fcpattern);
 
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts;
-				}
+			if (match && (curfont = xfont_create(drw, NULL, match))
+			&& XftCharExists(drw->dpy, curfont->xfont, utf8codepoint)) {
+				addfallback(curfont);
+				usedfont = curfont;
+			} else {
+				if (match)
+					xfont_free(curfont);
+				/* no font covers it, do not ask fontconfig again */
+				addmissing(utf8codepoint);
 			}
 		}
 	}
-	if (d)
-		XftDrawDestroy(d);
-
 	return x + (render ? w : 0);
 }
 
+int
+drw_sprite(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
+{
+	unsigned int i;
+	unsigned long fg, bg;
+	size_t len;
+	char *copy;
+
+	if (!drw || !drw->scheme || !text || !drw->fonts || !w || !h)
+		return drw_text(drw, x, y, w, h, lpad, text, invert);
+
+	fg = drw->scheme[ColFg].pixel;
+	bg = drw->scheme[ColBg].pixel;
+	len = strlen(text);
+	i = fnv1a(fnv1a(FNV1A_INIT, text, len), &fg, sizeof fg);
+	i = fnv1a(i, &bg, sizeof bg) & (SPRITES - 1);
+	if (sprites[i].set == drw->fonts && sprites[i].fg == fg
+	&& sprites[i].bg == bg && sprites[i].w == w && sprites[i].h == h
+	&& sprites[i].lpad == lpad && sprites[i].invert == invert
+	&& !strcmp(sprites[i].text, text)) {
+		XCopyArea(drw->dpy, sprites[i].pixmap, drw->drawable, drw->gc,
+		          0, 0, w, h, x, y);
+		return x + w;
+	}
+
+	/* render as usual, then keep a copy of the result */
+	drw_text(drw, x, y, w, h, lpad, text, invert);
+	if (!(copy = malloc(len + 1)))
+		return x + w;
+	memcpy(copy, text, len + 1);
+	if (sprites[i].set) {
+		XFreePixmap(drw->dpy, sprites[i].pixmap);
+		free(sprites[i].text);
+	}
+	sprites[i].set = drw->fonts;
+	sprites[i].text = copy;
+	sprites[i].fg = fg;
+	sprites[i].bg = bg;
+	sprites[i].w = w;
+	sprites[i].h = h;
+	sprites[i].lpad = lpad;
+	sprites[i].invert = invert;
+	sprites[i].pixmap = XCreatePixmap(drw->dpy, drw->root, w, h,
+	                                  DefaultDepth(drw->dpy, drw->screen));
+	XCopyArea(drw->dpy, drw->drawable, sprites[i].pixmap, drw->gc,
+	          x, y, w, h, 0, 0);
+	return x + w;
+}
+
 void
 drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 {
@@ -387,15 +621,30 @@ drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 		return;
 
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
 }
 
 unsigned int
 drw_fontset_getwidth(Drw *drw, const char *text)
 {
+	size_t len;
+	unsigned int i, w;
+	char *copy;
+
 	if (!drw || !drw->fonts || !text)
 		return 0;
-	return drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+	len = strlen(text);
+	i = fnv1a(FNV1A_INIT, text, len) & (WIDTHCACHE - 1);
+	if (widths[i].set == drw->fonts && !strcmp(widths[i].text, text))
+		return widths[i].w;
+	w = drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+	if ((copy = malloc(len + 1))) {
+		memcpy(copy, text, len + 1);
+		free(widths[i].text);
+		widths[i].set = drw->fonts;
+		widths[i].text = copy;
+		widths[i].w = w;
+	}
+	return w;
 }
 
 void
@@ -20,34 +20,53 @@
  *
  * To understand everything else, start reading main().
  */
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>
 #include <xcb/res.h>
+#include <xcb/xcbext.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif /* XRANDR */
 #include <X11/Xft/Xft.h>
 
 #include "drw.h"
 #include "util.h"
 
 /* macros */
+#define BARSEGMENTS                 (STATUSBLOCKS + NUMTAGS + 4)
+#define BARTEXTLENGTH               (STATUSLENGTH + 1024) /* texts of the bar as last drawn */
 #define BUTTONMASK                  (ButtonPressMask|ButtonReleaseMask)
 #define CLEANMASK(mask)             (mask & ~(numlockmask|LockMask) & (ShiftMask|ControlMask|Mod1Mask|Mod2Mask|Mod3Mask|Mod4Mask|Mod5Mask))
 #define INTERSECT(x,y,w,h,m)        (MAX(0, MIN((x)+(w),(m)->wx+(m)->ww) - MAX((x),(m)->wx)) \
@@ -63,6 +82,7 @@
 #define MWM_DECOR_BORDER            (1 << 1)
 #define MWM_DECOR_TITLE             (1 << 3)
 #define NUMTAGS                     9
+#define PROPLENGTH                  256 /* longest property read, in 32-bit units */
 #define RULE(...)                   { .monitor = -1, __VA_ARGS__ },
 #define WTYPE                       "_NET_WM_WINDOW_TYPE_"
 #define WIDTH(X)                    ((X)->w + 2 * (X)->bw)
@@ -72,8 +92,12 @@
 #define TEXTW(X)                    (drw_fontset_getwidth(drw, (X)) + lrpad)
 #define TTEXTW(X)                   (drw_fontset_getwidth(drw, (X)))
 
-#define STATUSLENGTH                256
-#define DWMBLOCKSLOCKFILE           "/var/local/dwmblocks/dwmblocks.pid"
+#define STATUSLENGTH                1024
+#define STATUSBLOCKS                64 /* blocks the status is split into at most */
+#define TRACELENGTH                 4096 /* events kept by the flight recorder, a power of two */
+#define STATUSSLOTS                 32 /* blocks addressable through the status socket */
+#define DWMBLOCKSLOCKDIR            "/var/local/dwmblocks"
+#define DWMBLOCKSLOCKFILE           DWMBLOCKSLOCKDIR "/dwmblocks.pid"
 #define DELIMITERENDCHAR            10
 #define LSPAD                       (lrpad / 2) /* padding on left side of status text */
 #define RSPAD                       (lrpad / 2) /* padding on right side of status text */
@@ -99,10 +123,23 @@ enum { NetSupported, NetWMName, NetWMState, NetWMStateAbove, NetWMCheck,
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
        NetWMWindowTypeDialog, NetClientList, NetDesktopNames,
        NetDesktopViewport, NetNumberOfDesktops, NetCurrentDesktop,
-       NetClientListStacking, NetLast }; /* EWMH atoms */
+       NetClientListStacking, NetWMPid, NetLast }; /* EWMH atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMWindowRole, WMLast }; /* default atoms */
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
+enum { FdX, FdStatus, FdFrame, FdSignal, FdBlocks, FdProc, FdLast }; /* event loop sources */
+enum { DirtyArrange = 1 << 0, DirtyRestack = 1 << 1,
+       DirtyBar = 1 << 2, DirtyFrame = 1 << 3 }; /* deferred monitor work */
+enum { SegInvert = 1 << 0, SegTopLine = 1 << 1, SegBottomLine = 1 << 2,
+       SegLineInvert = 1 << 3, SegFloatBox = 1 << 4,
+       SegFixed = 1 << 5, SegSprite = 1 << 6 }; /* bar segment decorations */
+enum { PropNetWMName, PropWMName, PropTransient, PropClass, PropRole,
+       PropState, PropWindowType, PropNormalHints, PropHints, PropMotif,
+       PropPid, PropLast }; /* properties fetched by manage() */
+enum { StatArrange, StatDrawbar, StatFocus, StatManage, StatUnmanage,
+       StatLast }; /* timed functions */
+enum { TraceArrange = LASTEvent, TraceDrawbar, TraceSync }; /* recorded
+       spans besides the X event handlers */
 
 typedef union {
 	int i;
@@ -135,6 +172,9 @@ struct Client {
 	int alwaysontop, neverfocus, oldstate, noswallow;
 	int ignoresizehints;
 	pid_t pid;
+	int pidquery; /* waiting for the XRes reply to pidck */
+	int unmapped; /* mapped by flushmons() once it has been arranged */
+	xcb_res_query_client_ids_cookie_t pidck;
 	Client *next;
 	Client *snext;
 	Client *swallowing;
@@ -154,6 +194,21 @@ typedef struct {
 	void (*arrange)(Monitor *);
 } Layout;
 
+typedef struct {
+	unsigned int off;     /* of its text in stext */
+	int scheme;           /* colour it is drawn with */
+	char end;             /* control byte that ends it, '\0' for the last */
+	unsigned int hash;
+	int w;
+} Block;
+
+typedef struct {
+	int x, w;
+	int scheme, pad, flags;
+	const char *text;     /* NULL for a plain fill */
+	unsigned int key;     /* hash of what the segment looks like */
+} Segment;
+
 typedef struct Pertag Pertag;
 struct Monitor {
 	char ltsymbol[16];
@@ -180,6 +235,12 @@ struct Monitor {
 	int topbar;
         int statushandcursor;
 	int focusedontop;
+	unsigned int dirty;   /* work deferred until the event batch ends */
+	unsigned long long frame; /* frame the bar was last painted in */
+	unsigned int nsegs;   /* bar segments as last drawn, 0 forces a redraw */
+	int segy, segh;
+	Segment segs[BARSEGMENTS];
+	char segtext[BARTEXTLENGTH]; /* copies of the texts in segs */
 	unsigned int seltags;
 	unsigned int sellt;
 	unsigned int tagset[2];
@@ -190,6 +251,7 @@ struct Monitor {
 	Monitor *next;
         Pertag *pertag;
 	Window barwin;
+	Drw *drw;             /* holds the bar as last drawn, ww x bh */
 	const Layout *lt[2];
 };
 
@@ -221,9 +283,50 @@ typedef struct {
 	int monitor;
 } Rule;
 
+typedef struct {
+	Window win; /* None if the slot was never used */
+	Client *c;  /* NULL if the window was removed */
+	int swallowed;
+} WinSlot;
+
+typedef struct {
+	pid_t pid;  /* 0 marks a free slot */
+	pid_t ppid; /* -1 marks an exited process */
+	unsigned long long start; /* clock ticks since boot, tells apart reused pids */
+	unsigned long long pstart; /* of the parent, 0 if it was not known */
+} ProcSlot;
+
+typedef struct {
+	pid_t pid;      /* 0 marks a free slot */
+	unsigned int n; /* terminals of this process, 0 once all are gone */
+	Client *c;      /* one of them, NULL when it has to be looked up */
+} TermSlot;
+
+typedef struct {
+	pid_t pid;
+	unsigned long long start;
+	pid_t ppid; /* the verdict is void once the process is reparented */
+	pid_t term; /* closest terminal among the ancestors */
+} Ancestry;
+
+typedef struct {
+	unsigned long calls;
+	unsigned long long ns;  /* time spent in all calls */
+	unsigned long hist[32]; /* calls taking from 2^i to 2^(i+1) ns */
+} Stat;
+
+typedef struct {
+	unsigned long long ts;
+	unsigned long win;
+	unsigned short kind; /* X event type or Trace* */
+	char ph;             /* 'B'egin or 'E'nd, as in Chrome traces */
+} TraceEvent;
+
 /* function declarations */
+static unsigned int addsegment(Segment *segs, unsigned int n, int x, int w,
+                        int scheme, int pad, const char *text, int flags);
 static void alwaysontop(const Arg *arg);
-static void applyrules(Client *c);
+static void applyrules(Client *c, xcb_get_property_reply_t **props);
 static int applysizehints(Client *c, int *x, int *y,
                                 int *w, int *h, int interact);
 static void arrange(Monitor *m);
@@ -231,6 +334,7 @@ static void arrangemon(Monitor *m);
 static void attach(Client *c);
 static void attachbelow(Client *c);
 static void attachstack(Client *c);
+static void beginresize(void);
 static void bstack(Monitor *m);
 static void buttonpress(XEvent *e);
 static void centeredfloatingmaster(Monitor *m);
@@ -239,9 +343,12 @@ static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
 static void clientmessage(XEvent *e);
+static unsigned long long clockns(void);
 static void configure(Client *c);
+static void copytextprop(XTextProperty *name, char *text, unsigned int size);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
+static void crashtrace(int sig);
 static Monitor *createmon(void);
 static void cyclelayout(const Arg *arg);
 static void defaultgaps(const Arg *arg);
@@ -249,20 +356,25 @@ static void destroynotify(XEvent *e);
 static void detach(Client *c);
 static void detachstack(Client *c);
 static Monitor *dirtomon(int dir);
+static void discardpid(Client *c);
 static void drawbar(Monitor *m);
 static void drawbars(void);
+static void drawframe(void);
+static void drawsegment(Monitor *m, Segment *s, int y, int h);
+static void dumpstats(void);
 static void dwindle(Monitor *m);
+static void endresize(void);
 static void enternotify(XEvent *e);
 static void expose(XEvent *e);
 static Client *findbefore(Client *c);
 static void floatpos(const Arg *arg);
+static void flushmons(void);
 static void focus(Client *c);
 static void focusin(XEvent *e);
 static void focusmaster(const Arg *arg);
 static void focusmon(const Arg *arg);
 static void focusstack(const Arg *arg);
 static void gaplessgrid(Monitor *m);
-static Atom getatomprop(Client *c, Atom prop);
 static void getfacts(Monitor *m, int msize, int ssize,
                         float *mf, float *sf, int *mr, int *sr);
 static void getfloatpos(int pos, char pCh, int size, char sCh,
@@ -270,7 +382,8 @@ static void getfloatpos(int pos, char pCh, int size, char sCh,
                         int defgrid, int *out_p, int *out_s);
 static void getgaps(Monitor *m, int *oh, int *ov,
                         int *ih, int *iv, unsigned int *nc);
-static pid_t getparentprocess(pid_t p);
+static pid_t getparentprocess(pid_t p, unsigned long long *start);
+static xcb_get_property_reply_t *getprop(Window w, Atom prop);
 static int getrootptr(int *x, int *y);
 static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
@@ -284,12 +397,18 @@ static void incrivgaps(const Arg *arg);
 static void incrogaps(const Arg *arg);
 static void incrohgaps(const Arg *arg);
 static void incrovgaps(const Arg *arg);
+static void indexproc(pid_t pid, pid_t ppid, unsigned long long start);
+static void indexterm(Client *c);
+static void indexwin(Window w, Client *c, int swallowed);
 static void inplacerotate(const Arg *arg);
 static void insertclient(Client *item, Client *insertItem, int after);
-static int isdescprocess(pid_t p, pid_t c);
+static Atom internreply(xcb_intern_atom_cookie_t ck);
 static void keypress(XEvent *e);
 static void killclient(const Arg *arg);
+static pid_t lockholder(void);
 static void manage(Window w, XWindowAttributes *wa);
+static int managepid(Client *c);
+static void mapclient(Client *c);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
 static void monocle(Monitor *m);
@@ -297,17 +416,39 @@ static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
 static Client *nexttagged(Client *c);
 static Client *nexttiled(Client *c);
+static unsigned int pidhash(pid_t pid);
 static void pop(Client *);
+static void printstat(const char *name, const Stat *s);
+static ProcSlot *procslot(pid_t pid);
 static void propertynotify(XEvent *e);
+static xcb_get_property_reply_t *propreply(xcb_get_property_cookie_t ck);
+static int proptext(xcb_get_property_reply_t *r, char *text, unsigned int size);
+static unsigned long propvalue(xcb_get_property_reply_t *r, Atom type);
+static char *putnum(char *p, unsigned long long n, unsigned int base);
+static char *putstr(char *p, const char *s);
+static xcb_res_query_client_ids_cookie_t querypid(Window w);
 static void quit(const Arg *arg);
+static void readblockswatch(void);
+static pid_t readppid(pid_t p, unsigned long long *start);
+static void readprocevents(void);
+static void readsignals(void);
+static void readstatus(void);
+static void rehashprocs(void);
+static void rehashterms(void);
+static void rehashwins(void);
 static Monitor *recttomon(int x, int y, int w, int h);
+static void requestprops(Window w, xcb_get_property_cookie_t *ck);
 static void resetfact(const Arg *arg);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
+static int resolvepids(void);
 static void restack(Monitor *m);
 static void run(void);
+static const char *runtimedir(void);
+static int samesegment(const Segment *a, const Segment *b);
 static void scan(void);
+static void scanprocs(void);
 static int sendevent(Client *c, Atom proto);
 static void sendmon(Client *c, Monitor *m);
 static void setcfact(const Arg *arg);
@@ -320,14 +461,22 @@ static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
 static void setlayout(const Arg *arg);
 static void setmfact(const Arg *arg);
+static void setmotifhints(Client *c, xcb_get_property_reply_t *r);
 static void setnumdesktops(void);
+static void setsizehints(Client *c, xcb_get_property_reply_t *r);
+static void setstatus(const char *rawstext);
+static void settitle(Client *c, xcb_get_property_reply_t *netname,
+                        xcb_get_property_reply_t *name);
 static void setup(void);
+static void setupprocs(void);
+static void setupstatus(void);
+static void setuptrace(void);
 static void setviewport(void);
 static void seturgent(Client *c, int urg);
+static void setwmhints(Client *c, xcb_get_property_reply_t *r);
 static void shiftclient(const Arg *arg);
 static void shiftview(const Arg *arg);
 static void showhide(Client *c);
-static void sigchld(int unused);
 static void sigdwmblocks(const Arg *arg);
 static void spawn(const Arg *arg);
 static void swallow(Client *p, Client *c);
@@ -335,7 +484,9 @@ static Client *swallowingclient(Window w);
 static void tag(const Arg *arg);
 static void tagmon(const Arg *arg);
 static void tagview(const Arg *arg);
+static unsigned long long tally(Stat *s, unsigned long long start);
 static Client *termforwin(const Client *c);
+static TermSlot *termslot(pid_t pid);
 static void tile(Monitor *);
 static void togglealttag(const Arg *arg);
 static void togglebar(const Arg *arg);
@@ -351,7 +502,12 @@ static void toggletitlecolor(const Arg *arg);
 static void toggletitlepos(const Arg *arg);
 static void togglevacanttag(const Arg *arg);
 static void toggleview(const Arg *arg);
+static void trace(char ph, unsigned int kind, unsigned long win,
+                unsigned long long ts);
 static void unfocus(Client *c, int setfocus);
+static void unindexproc(pid_t pid);
+static void unindexterm(Client *c);
+static void unindexwin(Window w);
 static void unmanage(Client *c, int destroyed);
 static void unmapnotify(XEvent *e);
 static void unswallow(Client *c);
@@ -360,6 +516,7 @@ static void updatebars(void);
 static void updateclientlist(void);
 static void updatecurrentdesktop(void);
 static void updatedwmblockssig(int x);
+static void updateframerate(void);
 static int updategeom(void);
 static void updatemotifhints(Client *c);
 static void updatenumlockmask(void);
@@ -368,27 +525,73 @@ static void updatestatus(void);
 static void updatetitle(Client *c);
 static void updatewmhints(Client *c);
 static void view(const Arg *arg);
-static pid_t winpid(Window w);
+static int waitframe(Monitor *m);
+static void watchfd(int fd, unsigned int id);
+static pid_t winpid(xcb_res_query_client_ids_reply_t *r);
+static WinSlot *winslot(Window w);
 static Client *wintoclient(Window w);
 static Monitor *wintomon(Window w);
+static void writetrace(void);
 static int xerror(Display *dpy, XErrorEvent *ee);
 static int xerrordummy(Display *dpy, XErrorEvent *ee);
 static int xerrorstart(Display *dpy, XErrorEvent *ee);
+static void xsync(void);
 static void zoom(const Arg *arg);
 
 /* variables */
 static const char broken[] = "broken";
-static char stextc[STATUSLENGTH];
-static char stexts[STATUSLENGTH];
+static char stext[STATUSLENGTH];     /* status blocks, NUL separated */
+static Block blocks[STATUSBLOCKS];
+static unsigned int nblocks;
+static char statusslots[STATUSSLOTS][STATUSLENGTH]; /* as sent to the socket */
+static char statuspath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int statusfd = -1;
+static int slotstatus;       /* the status socket took over from WM_NAME until it changes */
+static char rundir[PATH_MAX]; /* sockets and dumps go here */
+static int ownrundir;        /* rundir was made by dwm and is removed on exit */
 static int screen;
 static int sw, sh;           /* X display screen geometry width, height */
 static int bh, blw, ble;     /* bar geometry */
+static int deferring;        /* arrange/restack/drawbar only mark monitors dirty,
+                              * geometry is stale until flushmons() */
+static int mapspending;      /* some client is waiting for flushmons() to map it */
+static int resizing;         /* depth of nested resize transactions */
+static int pacing;           /* drawbar paints at most once per frame */
+static int barfd = -1;       /* timerfd waking up for the next frame */
+static unsigned long long armedframe;
+static unsigned long long frameperiod; /* ns between bar frames */
+static unsigned long suppressed; /* bar paints merged into a later frame */
+static Stat evstats[LASTEvent], stats[StatLast];
+static TraceEvent tracebuf[TRACELENGTH]; /* flight recorder */
+static unsigned long tracehead;
+static char tracepath[PATH_MAX];
+static const char *evnames[LASTEvent] = {
+	[ButtonPress] = "ButtonPress",
+	[ClientMessage] = "ClientMessage",
+	[ConfigureRequest] = "ConfigureRequest",
+	[ConfigureNotify] = "ConfigureNotify",
+	[DestroyNotify] = "DestroyNotify",
+	[EnterNotify] = "EnterNotify",
+	[Expose] = "Expose",
+	[FocusIn] = "FocusIn",
+	[KeyPress] = "KeyPress",
+	[MappingNotify] = "MappingNotify",
+	[MapRequest] = "MapRequest",
+	[MotionNotify] = "MotionNotify",
+	[PropertyNotify] = "PropertyNotify",
+	[UnmapNotify] = "UnmapNotify",
+};
+static int epfd = -1;        /* epoll instance the event loop sleeps on */
+static int sigfd = -1;       /* signalfd for the signals in sigmask */
+static sigset_t sigmask, origmask;
 static int wstext;           /* width of status text */
 static int lrpad;            /* sum of left and right padding for text */
 static int vp;               /* vertical padding for bar */
 static int sp;               /* side padding for bar */
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int dwmblockssig;
+static pid_t blockspid;      /* dwmblocks lock holder, 0 when unknown */
+static int blocksfd = -1;    /* inotify watching the lock file */
 static unsigned int numlockmask = 0;
 static void (*handler[LASTEvent]) (XEvent *) = {
 	[ButtonPress] = buttonpress,
@@ -406,7 +609,7 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 	[PropertyNotify] = propertynotify,
 	[UnmapNotify] = unmapnotify
 };
-static Atom wmatom[WMLast], netatom[NetLast], motifatom;
+static Atom wmatom[WMLast], netatom[NetLast], motifatom, floatingatom;
 static int running = 1;
 static Cur *cursor[CurLast];
 static Clr **scheme;
@@ -414,15 +617,56 @@ static Display *dpy;
 static Drw *drw;
 static Monitor *mons, *selmon;
 static Window root, wmcheckwin;
+static Window *clientlist, *clientstack; /* as last published on the root */
+static unsigned int nclientlist, clientlistsize;
+static int clientlistdirty;
+static WinSlot *wins; /* client windows by hash, swallowed ones included */
+static unsigned int winssize, winsused;
+static ProcSlot *procs; /* parent of every process, kept by proc events */
+static unsigned int procssize, procsused;
+static int procfd = -1; /* netlink proc connector, procs is unused without */
+static unsigned long long nsperclk; /* unit of /proc start times */
+static int xres;        /* the server tells client pids */
+static unsigned int npidqueries; /* clients with pidquery set */
+static TermSlot *terms; /* pids of terminals that can swallow */
+static unsigned int termssize, termsused;
+static Ancestry ancestry[64]; /* last walks from a process to its terminal */
 static xcb_connection_t *xcon;
 
 /* configuration, allows nested code to access above variables */
 #include "config.h"
 
+/* widths of the tag labels, measured once in setup() */
+static int tagw[LENGTH(tags)], tagaltw[LENGTH(tags)];
+
+/* _NET_WM_WINDOW_TYPE of each rule, interned in setup() */
+static Atom ruletypes[LENGTH(rules)];
+
 /* compile-time check if all tags fit into an unsigned int bit array. */
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
 /* function implementations */
+unsigned int
+addsegment(Segment *segs, unsigned int n, int x, int w,
+        int scheme, int pad, const char *text, int flags)
+{
+	Segment *s = &segs[n];
+	int geom[] = { w, scheme, pad, flags };
+
+	if (w <= 0 || n >= BARSEGMENTS)
+		return n;
+	s->x = x;
+	s->w = w;
+	s->scheme = scheme;
+	s->pad = pad;
+	s->flags = flags;
+	s->text = text;
+	s->key = fnv1a(FNV1A_INIT, geom, sizeof geom);
+	if (text)
+		s->key = fnv1a(s->key, text, strlen(text));
+	return n + 1;
+}
+
 void
 alwaysontop(const Arg *arg)
 {
@@ -431,15 +675,15 @@ alwaysontop(const Arg *arg)
 }
 
 void
-applyrules(Client *c)
+applyrules(Client *c, xcb_get_property_reply_t **props)
 {
-	const char *class, *instance;
+	const char *class = broken, *instance = broken;
 	Atom wintype;
-	char role[64];
-	unsigned int i;
+	char role[64], hint[PROPLENGTH * 4 + 1];
+	unsigned int i, n;
 	const Rule *r;
 	Monitor *m;
-	XClassHint ch = { NULL, NULL };
+	xcb_get_property_reply_t *ch = props[PropClass];
 
 	/* rule matching */
 	c->isfloating = 0;
@@ -447,11 +691,16 @@ applyrules(Client *c)
         c->isfloatpos = 0;
         c->noswallow = 0;
 	c->tags = 0;
-	XGetClassHint(dpy, c->win, &ch);
-	class    = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name  ? ch.res_name  : broken;
-	wintype  = getatomprop(c, netatom[NetWMWindowType]);
-	gettextprop(c->win, wmatom[WMWindowRole], role, sizeof(role));
+	if (ch && ch->type == XA_STRING && ch->format == 8) {
+		/* WM_CLASS holds the instance and class, each NUL-terminated */
+		n = MIN(xcb_get_property_value_length(ch), sizeof hint - 1);
+		memcpy(hint, xcb_get_property_value(ch), n);
+		hint[n] = '\0';
+		instance = hint;
+		class = hint + strlen(hint) + (strlen(hint) < n);
+	}
+	wintype = propvalue(props[PropWindowType], XA_ATOM);
+	proptext(props[PropRole], role, sizeof role);
 
 	for (i = 0; i < LENGTH(rules); i++) {
 		r = &rules[i];
@@ -459,7 +708,7 @@ applyrules(Client *c)
 		&& (!r->class || strstr(class, r->class))
 		&& (!r->role || strstr(role, r->role))
 		&& (!r->instance || strstr(instance, r->instance))
-		&& (!r->wintype || wintype == XInternAtom(dpy, r->wintype, 0)))
+		&& (!r->wintype || wintype == ruletypes[i]))
 		{
 			c->isterminal = r->isterminal;
 			c->noswallow  = r->noswallow;
@@ -478,10 +727,6 @@ applyrules(Client *c)
                                 break;
 		}
 	}
-	if (ch.res_class)
-		XFree(ch.res_class);
-	if (ch.res_name)
-		XFree(ch.res_name);
 	c->tags = c->tags & TAGMASK
                         ? c->tags & TAGMASK
                         : c->mon->tagset[c->mon->seltags];
@@ -557,23 +802,41 @@ applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 void
 arrange(Monitor *m)
 {
+	PROBE2(arrange, m ? m->num : -1, deferring); /* deferred ones end in arrangemon */
+	if (deferring) {
+		if (m)
+			m->dirty |= DirtyArrange|DirtyRestack;
+		else for (m = mons; m; m = m->next)
+			m->dirty |= DirtyArrange;
+		return;
+	}
+	beginresize();
 	if (m)
 		showhide(m->stack);
 	else for (m = mons; m; m = m->next)
 		showhide(m->stack);
-	if (m) {
+	if (m)
 		arrangemon(m);
-		restack(m);
-	} else for (m = mons; m; m = m->next)
+	else for (m = mons; m; m = m->next)
 		arrangemon(m);
+	endresize();
+	if (m)
+		restack(m);
 }
 
 void
 arrangemon(Monitor *m)
 {
+	unsigned long long t = clockns();
+
+	trace('B', TraceArrange, m->barwin, t);
+	PROBE2(arrangemon, m->num, m->lt[m->sellt]->symbol);
 	strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol);
+	beginresize();
 	if (m->lt[m->sellt]->arrange)
 		m->lt[m->sellt]->arrange(m);
+	endresize();
+	trace('E', TraceArrange, m->barwin, tally(&stats[StatArrange], t));
 }
 
 void
@@ -581,6 +844,7 @@ attach(Client *c)
 {
 	c->next = c->mon->clients;
 	c->mon->clients = c;
+	clientlistdirty = 1;
 }
 
 void
@@ -596,6 +860,7 @@ attachbelow(Client *c)
                 }
                 c->next = at->next;
                 at->next = c;
+                clientlistdirty = 1;
                 return;
 	}
 
@@ -604,6 +869,7 @@ attachbelow(Client *c)
 	c->next = c->mon->sel->next;
 	/* Set the currently selected clients next property to the new client */
 	c->mon->sel->next = c;
+	clientlistdirty = 1;
 }
 
 void
@@ -611,6 +877,15 @@ attachstack(Client *c)
 {
 	c->snext = c->mon->stack;
 	c->mon->stack = c;
+	clientlistdirty = 1;
+}
+
+/* Resizes inside a transaction are sent back to back without waiting for the
+ * server; the outermost endresize() flushes them all at once. */
+void
+beginresize(void)
+{
+	resizing++;
 }
 
 /*
@@ -629,6 +904,7 @@ bstack(Monitor *m)
 	Client *c;
 
 	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	PROBE2(bstack, m->num, n);
 	if (n == 0)
 		return;
 
@@ -673,6 +949,7 @@ buttonpress(XEvent *e)
 	Client *c;
 	Monitor *m;
 	XButtonPressedEvent *ev = &e->xbutton;
+	int defer = deferring, pace = pacing;
 
 	/* focus monitor if necessary */
 	if ((m = wintomon(ev->window)) && m != selmon) {
@@ -681,6 +958,16 @@ buttonpress(XEvent *e)
 		focus(NULL);
 	}
 	if (ev->window == selmon->barwin) {
+                /* blw and ble are only current once the bar is painted,
+                 * which may be held back for this batch or frame */
+                if (selmon->dirty) {
+                        deferring = pacing = 0;
+                        flushmons();
+                        if (selmon->dirty & DirtyFrame)
+                                drawbar(selmon);
+                        deferring = defer;
+                        pacing = pace;
+                }
                 if (ev->x < ble - blw) {
                         for (c = m->clients;
                         !selmon->showvacanttags && c;
@@ -694,7 +981,7 @@ buttonpress(XEvent *e)
                                         || m->tagset[m->seltags] & 1 << i))
                                                 continue;
                                 }
-                                x += TEXTW(tags[i]);
+                                x += tagw[i];
                         } while (ev->x >= x && ++i < LENGTH(tags));
                         if (i < LENGTH(tags)) {
                                 click = ClkTagBar;
@@ -745,6 +1032,7 @@ centeredfloatingmaster(Monitor *m)
 	Client *c;
 
 	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	PROBE2(centeredfloatingmaster, m->num, n);
 	if (n == 0)
 		return;
 
@@ -807,6 +1095,7 @@ centeredmaster(Monitor *m)
 	Client *c;
 
 	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	PROBE2(centeredmaster, m->num, n);
 	if (n == 0)
 		return;
 
@@ -921,7 +1210,30 @@ cleanup(void)
 		free(scheme[i]);
         free(scheme);
 	XDestroyWindow(dpy, wmcheckwin);
+	drw_fontset_free(drw->fonts);
 	drw_free(drw);
+	free(wins);
+	free(clientlist);
+	free(clientstack);
+	if (statusfd >= 0) {
+		close(statusfd);
+		unlink(statuspath);
+	}
+	if (ownrundir) {
+		if (tracepath[0])
+			unlink(tracepath);
+		rmdir(rundir);
+	}
+	if (barfd >= 0)
+		close(barfd);
+	if (blocksfd >= 0)
+		close(blocksfd);
+	if (procfd >= 0)
+		close(procfd);
+	free(procs);
+	free(terms);
+	close(sigfd);
+	close(epfd);
 	XSync(dpy, 0);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
@@ -940,6 +1252,7 @@ cleanupmon(Monitor *mon)
 	}
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
+	drw_free(mon->drw);
         free(mon->pertag);
 	free(mon);
 }
@@ -975,6 +1288,15 @@ clientmessage(XEvent *e)
 	}
 }
 
+unsigned long long
+clockns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 void
 configure(Client *c)
 {
@@ -1008,7 +1330,6 @@ configurenotify(XEvent *e)
 		sw = ev->width;
 		sh = ev->height;
 		if (updategeom() || dirty) {
-			drw_resize(drw, sw, bh);
 			updatebars();
 			for (m = mons; m; m = m->next) {
 				for (c = m->clients; c; c = c->next)
@@ -1019,6 +1340,7 @@ configurenotify(XEvent *e)
                                         m->wx + sp, m->by + vp,
                                         m->ww -  2 * sp, bh);
 			}
+			updateframerate();
 			focus(NULL);
 			arrange(NULL);
 		}
@@ -1076,7 +1398,34 @@ configurerequest(XEvent *e)
 		wc.stack_mode = ev->detail;
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
 	}
-	XSync(dpy, 0);
+	xsync();
+}
+
+void
+copytextprop(XTextProperty *name, char *text, unsigned int size)
+{
+	char **list = NULL;
+	int n;
+
+	if (name->encoding == XA_STRING) {
+		/* the value is not NUL-terminated when it comes from xcb */
+		n = MIN(name->nitems, size - 1);
+		memcpy(text, name->value, n);
+		text[n] = '\0';
+	} else if (XmbTextPropertyToTextList(dpy, name, &list, &n) >= Success
+	&& n > 0 && *list) {
+		strncpy(text, *list, size - 1);
+		text[size - 1] = '\0';
+		XFreeStringList(list);
+	}
+}
+
+/* dump the flight recorder before dying, must be async-signal-safe */
+void
+crashtrace(int sig)
+{
+	writetrace();
+	raise(sig); /* the handler was reset by SA_RESETHAND */
 }
 
 Monitor *
@@ -1178,6 +1527,7 @@ detach(Client *c)
 
 	for (tc = &c->mon->clients; *tc && *tc != c; tc = &(*tc)->next);
 	*tc = c->next;
+	clientlistdirty = 1;
 }
 
 void
@@ -1187,6 +1537,7 @@ detachstack(Client *c)
 
 	for (tc = &c->mon->stack; *tc && *tc != c; tc = &(*tc)->snext);
 	*tc = c->snext;
+	clientlistdirty = 1;
 
 	if (c == c->mon->sel) {
 		for (t = c->mon->stack; t && !ISVISIBLE(t); t = t->snext);
@@ -1209,52 +1560,56 @@ dirtomon(int dir)
 	return m;
 }
 
+/* c leaves the client lists that resolvepids() walks */
+void
+discardpid(Client *c)
+{
+	if (!c->pidquery)
+		return;
+	xcb_discard_reply(xcon, c->pidck.sequence);
+	c->pidquery = 0;
+	npidqueries--;
+}
+
 void
 drawbar(Monitor *m)
 {
-	int x, w, wdelta, tagscheme;
+	int x, w, wdelta, scm, flags, full, dx, dw;
+	size_t len, used;
         int y = m->bargap || gaplessborder ? barborder : 0;
         int h = bh - y * 2;
-	int boxs = drw->fonts->h / 9;
-	int boxw = drw->fonts->h / 6 + 2;
         unsigned int titlepad = lrpad / 2;
-	unsigned int i, occ = 0, urg = 0;
+	unsigned int i, n = 0, occ = 0, urg = 0;
+	Segment segs[BARSEGMENTS], *s;
 	Client *c;
+	unsigned long long t;
 
-        /* draw rectangle that will look like border */
-        XSetForeground(drw->dpy, drw->gc, scheme[SchemeBar][ColBorder].pixel);
-        XFillRectangle(drw->dpy, drw->drawable, drw->gc, 0, 0, m->ww, bh);
+	if (deferring) {
+		m->dirty |= DirtyBar;
+		return;
+	}
+	if (pacing && waitframe(m))
+		return;
+	t = clockns();
+	trace('B', TraceDrawbar, m->barwin, t);
+	PROBE2(drawbar, m->num, m->barwin);
+	m->dirty &= ~DirtyFrame;
+	if (m->drw->w != m->ww || m->drw->h != bh) {
+		drw_resize(m->drw, m->ww, bh);
+		m->nsegs = 0;
+	}
 
-	/* draw status first so it can be overdrawn by tags later */
+	/* lay out the status first so it can be overdrawn by tags later */
 	if (m == selmon) { /* status is only drawn on selected monitor */
-                char *stc = stextc;
-                char *stp = stextc;
-                char tmp;
-
-                drw_setscheme(drw, scheme[SchemeBar]);
                 x = m->ww - wstext - 2 * sp;
-                drw_rect(drw, x, y, LSPAD, h, 1, 1); x += LSPAD; /* to keep left padding clean */
-                for (;;) {
-                        if ((unsigned char)*stc >= ' ') {
-                                stc++;
-                                continue;
-                        }
-                        tmp = *stc;
-                        if (stp != stc) {
-                                *stc = '\0';
-                                x = drw_text(drw, x, y,
-                                        TTEXTW(stp), h, 0, stp, 0);
-                        }
-                        if (tmp == '\0')
-                                break;
-                        if (tmp - DELIMITERENDCHAR - 1 < LENGTH(colors))
-                                drw_setscheme(drw,
-                                        scheme[tmp - DELIMITERENDCHAR - 1]);
-                        *stc = tmp;
-                        stp = ++stc;
+                n = addsegment(segs, n, x, LSPAD, SchemeBar, 0, NULL, 0); /* to keep left padding clean */
+                x += LSPAD;
+                for (i = 0; i < nblocks; i++) {
+                        n = addsegment(segs, n, x, blocks[i].w, blocks[i].scheme,
+                                0, stext + blocks[i].off, 0);
+                        x += blocks[i].w;
                 }
-                drw_setscheme(drw, scheme[SchemeBar]);
-                drw_rect(drw, x, y, LSPAD - y, h, 1, 1); /* to keep right padding clean */
+                n = addsegment(segs, n, x, LSPAD - y, SchemeBar, 0, NULL, 0); /* to keep right padding clean */
 	}
 
         for (c = m->clients; c; c = c->next) {
@@ -1264,60 +1619,47 @@ drawbar(Monitor *m)
         }
         x = y;
         for (i = 0; i < LENGTH(tags); i++) {
-                tagscheme = SchemeTag;
+                scm = SchemeTag;
                 /* do not draw vacant tags on current monitor */
                 if (!m->showvacanttags
                 && !(occ & 1 << i || m->tagset[m->seltags] & 1 << i))
                         continue;
-                w = TEXTW(tags[i]);
-                wdelta = m->alttag ? (TEXTW(tagsalt[i]) - w) / 2 : 0;
+                w = tagw[i];
+                wdelta = m->alttag ? (tagaltw[i] - w) / 2 : 0;
                 if (m == selmon && m->tagset[m->seltags] & 1 << i) {
-                        tagscheme = SchemeBar;
+                        scm = SchemeBar;
                         if (m->sel && m->sel->tags & 1 << i)
-                                tagscheme = m->colorfultag
+                                scm = m->colorfultag
                                                 ? tagschemes[i] : SchemeSel;
                         else if (m->sel && m->colorfultag && m->showindicator)
-                                tagscheme = tagschemes[i];
+                                scm = tagschemes[i];
                         else if (m->sel && !m->showvacanttags)
-                                tagscheme = SchemeTag;
+                                scm = SchemeTag;
                 }
-                drw_setscheme(drw, scheme[tagscheme]);
-                drw_text(drw, x, y, w + y, h, wdelta + lrpad / 2,
-                        m->alttag ? tagsalt[i] : tags[i], urg & 1 << i);
-                /* draw bar indicator for selected tag */
-                /* check if the tag not a vacant tag*/
+                flags = SegSprite | (urg & 1 << i ? SegInvert : 0)
+                        | (urg & 1 << 1 ? SegLineInvert : 0);
+                /* bar indicator, only for tags that are not vacant */
                 if (occ & 1 << i) {
-                        /* draw for current monitor and selected tag */
+                        /* full line at the top of a selected tag that has the
+                         * selected client, smaller line at the bottom of other
+                         * selected tags, half line at the bottom of every non
+                         * vacant tag */
                         if (m == selmon && m->tagset[m->seltags] & 1 << i) {
-                                if (m->sel->tags & 1 << i)
-                                /* draw full line at the top of selected tag
-                                * that have clients */
-                                        drw_rect(m->showindicator ? drw : NULL,
-                                                x, y, w, boxw - 2,
-                                                1, urg & 1 << 1);
+                                if (m->sel && m->sel->tags & 1 << i)
+                                        flags |= m->showindicator ? SegTopLine : 0;
                                 else if (!m->showvacanttags)
-                                /* if more than one tag selected, draw smaller
-                                 * line at the bottom of another selected non
-                                 * vacant tag */
-                                        drw_rect(drw,
-                                                x + (3 * boxw + 1),
-                                                h - (boxw - 2),
-                                                w - (6 * boxw + 1), boxw - 2,
-                                                1, urg & 1 << 1);
-                        } else {
-                                /* draw half line at the bottom of every non
-                                 * vacant tag */
-                                drw_rect(m->showvacanttags ? drw : NULL,
-                                        x + (3 * boxw + 1), h - (boxw - 2),
-                                        w - (6 * boxw + 1), boxw - 2,
-                                        1, urg & 1 << 1);
-                        }
+                                        flags |= SegBottomLine;
+                        } else if (m->showvacanttags)
+                                flags |= SegBottomLine;
                 }
+                n = addsegment(segs, n, x, w, scm, wdelta + lrpad / 2,
+                        m->alttag ? tagsalt[i] : tags[i], flags);
                 x += w;
         }
         w = TEXTW(m->ltsymbol);
-        drw_setscheme(drw, scheme[m == selmon ? SchemeLayout : SchemeInactive]);
-        x = drw_text(drw, x, y, w, h, lrpad / 2, m->ltsymbol, 0);
+        n = addsegment(segs, n, x, w, m == selmon ? SchemeLayout : SchemeInactive,
+                lrpad / 2, m->ltsymbol, SegSprite);
+        x += w;
 
         if (m == selmon) {
                 blw = w, ble = x;
@@ -1327,15 +1669,14 @@ drawbar(Monitor *m)
         }
 	if (w > h) {
 		if (m->sel && m->showtitle) {
-                        if (m->colorfultitle)
+                        scm = m == selmon ? SchemeLayout : SchemeInactive;
+                        if (m == selmon && m->colorfultitle) {
                                 for (i = 0; i < LENGTH(tags); i++)
-                                        drw_setscheme(m->sel->tags & 1 << i
-                                                && m == selmon ? drw : NULL,
-                                                scheme[titleschemes[i]]);
-                        else
-                                drw_setscheme(m == selmon ? drw : NULL,
-                                        scheme[m->sel->isfloating ?
-                                        SchemeTitleFloat : SchemeTitle]);
+                                        if (m->sel->tags & 1 << i)
+                                                scm = titleschemes[i];
+                        } else if (m == selmon)
+                                scm = m->sel->isfloating
+                                        ? SchemeTitleFloat : SchemeTitle;
                         if (m->centertitle) {
                                 int width = w - 2 * sp;
                                 int txtwidth = (int)(TEXTW(m->sel->name))
@@ -1345,17 +1686,69 @@ drawbar(Monitor *m)
                                                 ? centerpad - sp
                                                 : (lrpad / 2) + ((2 * sp) / 2);
                         }
-			drw_text(drw, x, y, w - 2 * sp, h,
-                                titlepad, m->sel->name, 0);
-                        drw_rect(m->sel->isfloating ? drw : NULL,
-                                x + boxs + titlepad - lrpad / 2, boxs + y,
-                                boxw, boxw, m->sel->isfixed, 0);
-		} else {
-			drw_setscheme(drw, scheme[SchemeBar]);
-			drw_rect(drw, x, y, w - 2 * sp, h, 1, 1);
-		}
+                        flags = (m->sel->isfloating ? SegFloatBox : 0)
+                                | (m->sel->isfixed ? SegFixed : 0);
+                        n = addsegment(segs, n, x, w - 2 * sp, scm,
+                                titlepad, m->sel->name, flags);
+		} else
+                        n = addsegment(segs, n, x, w - 2 * sp, SchemeBar, 0, NULL, 0);
 	}
-	drw_map(drw, m->barwin, 0, 0, m->ww, bh);
+
+        /* redraw everything when the layout moved or the status runs under
+         * the tags, otherwise only the segments that look different */
+        full = n != m->nsegs || y != m->segy || h != m->segh
+                || (m == selmon && x > m->ww - wstext - 2 * sp);
+        for (i = 0; !full && i < n; i++)
+                full = segs[i].x != m->segs[i].x || segs[i].w != m->segs[i].w;
+
+        /* draw rectangle that will look like border */
+        if (full) {
+                XSetForeground(m->drw->dpy, m->drw->gc, scheme[SchemeBar][ColBorder].pixel);
+                XFillRectangle(m->drw->dpy, m->drw->drawable, m->drw->gc, 0, 0, m->ww, bh);
+        }
+        dx = dw = 0;
+        for (i = 0; i < n; i++) {
+                s = &segs[i];
+                if (!full && samesegment(s, &m->segs[i]))
+                        continue;
+                if (!full) {
+                        XSetForeground(m->drw->dpy, m->drw->gc, scheme[SchemeBar][ColBorder].pixel);
+                        XFillRectangle(m->drw->dpy, m->drw->drawable, m->drw->gc,
+                                s->x, 0, s->w, bh);
+                        /* copy adjacent damage in one go */
+                        if (dw && s->x != dx + dw) {
+                                drw_map(m->drw, m->barwin, dx, 0, dw, bh);
+                                dw = 0;
+                        }
+                        if (!dw)
+                                dx = s->x;
+                        dw += s->w;
+                }
+                drawsegment(m, s, y, h);
+        }
+        if (full)
+                drw_map(m->drw, m->barwin, 0, 0, m->ww, bh);
+        else if (dw)
+                drw_map(m->drw, m->barwin, dx, 0, dw, bh);
+        xsync(); /* once for all the copies */
+
+        /* keep copies of the texts, they may change before the next paint */
+        for (i = 0, used = 0; i < n; i++) {
+                m->segs[i] = segs[i];
+                if (!segs[i].text)
+                        continue;
+                len = strlen(segs[i].text) + 1;
+                if (used + len > sizeof m->segtext) {
+                        n = 0; /* redraw everything next time */
+                        break;
+                }
+                m->segs[i].text = memcpy(m->segtext + used, segs[i].text, len);
+                used += len;
+        }
+        m->nsegs = n;
+        m->segy = y;
+        m->segh = h;
+	trace('E', TraceDrawbar, m->barwin, tally(&stats[StatDrawbar], t));
 }
 
 void
@@ -1367,6 +1760,76 @@ drawbars(void)
 		drawbar(m);
 }
 
+/* paint the bars that were held back for this frame */
+void
+drawframe(void)
+{
+	Monitor *m;
+	unsigned long long expired;
+	int pace = pacing;
+
+	if (read(barfd, &expired, sizeof expired) < 0)
+		return;
+	pacing = 0;
+	for (m = mons; m; m = m->next)
+		if (m->dirty & DirtyFrame) {
+			m->frame = armedframe;
+			drawbar(m);
+		}
+	pacing = pace;
+}
+
+void
+drawsegment(Monitor *m, Segment *s, int y, int h)
+{
+	int boxs = drw->fonts->h / 9;
+	int boxw = drw->fonts->h / 6 + 2;
+
+	drw_setscheme(m->drw, scheme[s->scheme]);
+	if (!s->text) {
+		drw_rect(m->drw, s->x, y, s->w, h, 1, 1);
+		return;
+	}
+	if (s->flags & SegSprite) /* labels that come back over and over */
+		drw_sprite(m->drw, s->x, y, s->w, h, s->pad, s->text, s->flags & SegInvert);
+	else
+		drw_text(m->drw, s->x, y, s->w, h, s->pad, s->text, s->flags & SegInvert);
+	if (s->flags & SegTopLine)
+		drw_rect(m->drw, s->x, y, s->w, boxw - 2,
+                        1, s->flags & SegLineInvert);
+	else if (s->flags & SegBottomLine)
+		drw_rect(m->drw, s->x + (3 * boxw + 1), h - (boxw - 2),
+                        s->w - (6 * boxw + 1), boxw - 2,
+                        1, s->flags & SegLineInvert);
+	if (s->flags & SegFloatBox)
+		drw_rect(m->drw, s->x + boxs + s->pad - lrpad / 2, boxs + y,
+                        boxw, boxw, s->flags & SegFixed, 0);
+}
+
+void
+dumpstats(void)
+{
+	static const char *names[StatLast] = {
+		[StatArrange] = "arrange",
+		[StatDrawbar] = "drawbar",
+		[StatFocus] = "focus",
+		[StatManage] = "manage",
+		[StatUnmanage] = "unmanage",
+	};
+	unsigned int i;
+
+	fprintf(stderr, "dwm: %-16s %8s %10s  log2(ns):calls\n",
+	        "", "calls", "total us");
+	for (i = 0; i < LENGTH(evstats); i++)
+		if (evstats[i].calls)
+			printstat(evnames[i] ? evnames[i] : "other", &evstats[i]);
+	for (i = 0; i < LENGTH(stats); i++)
+		if (stats[i].calls)
+			printstat(names[i], &stats[i]);
+	fprintf(stderr, "dwm: %lu bar redraws merged into later frames\n",
+	        suppressed);
+}
+
 void
 dwindle(Monitor *m)
 {
@@ -1377,6 +1840,7 @@ dwindle(Monitor *m)
 	Client *c;
 
 	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	PROBE2(dwindle, m->num, n);
 	if (n == 0)
 		return;
 
@@ -1438,6 +1902,13 @@ dwindle(Monitor *m)
 	}
 }
 
+void
+endresize(void)
+{
+	if (resizing && !--resizing)
+		XFlush(dpy);
+}
+
 void
 enternotify(XEvent *e)
 {
@@ -1466,7 +1937,12 @@ expose(XEvent *e)
 	Monitor *m;
 	XExposeEvent *ev = &e->xexpose;
 
-	if (ev->count == 0 && (m = wintomon(ev->window)))
+	if (!(m = wintomon(ev->window)))
+		return;
+	if (ev->window == m->barwin && m->nsegs)
+		/* the bar's pixmap still holds what was last drawn */
+		drw_map(m->drw, m->barwin, ev->x, ev->y, ev->width, ev->height);
+	else if (ev->count == 0)
 		drawbar(m);
 }
 
@@ -1495,11 +1971,51 @@ floatpos(const Arg *arg)
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w/2, c->h/2);
 }
 
+/* carry out the work the handlers of an event batch have deferred, once per
+ * dirty monitor */
+void
+flushmons(void)
+{
+	Monitor *m;
+	Client *c;
+	unsigned int dirty;
+
+	beginresize();
+	for (m = mons; m; m = m->next)
+		if (m->dirty & DirtyArrange)
+			showhide(m->stack);
+	for (m = mons; m; m = m->next)
+		if (m->dirty & DirtyArrange)
+			arrangemon(m);
+	endresize();
+	if (mapspending) {
+		for (m = mons; m; m = m->next)
+			for (c = m->clients; c; c = c->next)
+				if (c->unmapped) {
+					XMapWindow(dpy, c->win);
+					c->unmapped = 0;
+					if (c == selmon->sel)
+						setfocus(c); /* failed while unmapped */
+				}
+		mapspending = 0;
+	}
+	for (m = mons; m; m = m->next) {
+		dirty = m->dirty;
+		m->dirty &= DirtyFrame;
+		if (dirty & DirtyRestack)
+			restack(m);
+		else if (dirty & DirtyBar)
+			drawbar(m);
+	}
+}
+
 void
 focus(Client *c)
 {
 	Client *f;
 	XWindowChanges wc;
+	unsigned long long t = clockns();
+
 	if (!c || !ISVISIBLE(c))
 		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
 	if (selmon->sel && selmon->sel != c)
@@ -1556,6 +2072,7 @@ focus(Client *c)
 	}
 	selmon->sel = c;
 	drawbars();
+	tally(&stats[StatFocus], t);
 }
 
 /* there are some broken focus acquiring clients needing extra handling */
@@ -1634,6 +2151,7 @@ gaplessgrid(Monitor *m)
 	Client *c;
 
 	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	PROBE2(gaplessgrid, m->num, n);
 	if (n == 0) return;
 
 	/* grid dimensions */
@@ -1669,23 +2187,6 @@ gaplessgrid(Monitor *m)
 	}
 }
 
-Atom
-getatomprop(Client *c, Atom prop)
-{
-	int di;
-	unsigned long dl;
-	unsigned char *p = NULL;
-	Atom da, atom = None;
-
-	if (XGetWindowProperty(dpy, c->win, prop, 0L, sizeof atom, 0, XA_ATOM,
-		        &da, &di, &dl, &dl, &p)
-        == Success && p) {
-		atom = *(Atom *)p;
-		XFree(p);
-	}
-	return atom;
-}
-
 void
 getfacts(Monitor *m, int msize, int ssize,
         float *mf, float *sf, int *mr, int *sr)
@@ -1835,18 +2336,32 @@ getgaps(Monitor *m, int *oh, int *ov, int *ih, int *iv, unsigned int *nc)
 }
 
 pid_t
-getparentprocess(pid_t p)
-{
-	unsigned int v = 0;
-	FILE *f;
-	char buf[256];
-	snprintf(buf, sizeof(buf) - 1, "/proc/%u/stat", (unsigned)p);
-
-	if (!(f = fopen(buf, "r"))) return 0;
+getparentprocess(pid_t p, unsigned long long *start)
+{
+	ProcSlot *s, *q;
+	pid_t ppid;
+
+	if (procfd < 0 || !procs)
+		return readppid(p, start);
+	/* orphans get a new parent without an event, so only trust ppid
+	 * while the process it was forked from is still around */
+	if ((s = procslot(p))->pid == p && s->ppid >= 0
+	&& (s->ppid == 1 || ((q = procslot(s->ppid))->pid == s->ppid
+	&& q->ppid >= 0 && s->pstart && q->start == s->pstart))) {
+		*start = s->start;
+		return s->ppid;
+	}
+	/* not seen yet, the fork may have raced with the scan */
+	if ((ppid = readppid(p, start)))
+		indexproc(p, ppid, *start);
+	return ppid;
+}
 
-	fscanf(f, "%*u %*s %*c %u", &v);
-	fclose(f);
-	return (pid_t)v;
+xcb_get_property_reply_t *
+getprop(Window w, Atom prop)
+{
+	return propreply(xcb_get_property(xcon, 0, w, prop,
+                        XCB_GET_PROPERTY_TYPE_ANY, 0, PROPLENGTH));
 }
 
 int
@@ -1881,24 +2396,13 @@ getstate(Window w)
 int
 gettextprop(Window w, Atom atom, char *text, unsigned int size)
 {
-	char **list = NULL;
-	int n;
 	XTextProperty name;
 
 	if (!text || size == 0) return 0;
 	text[0] = '\0';
 	if (!XGetTextProperty(dpy, w, &name, atom) || !name.nitems)
 		return 0;
-	if (name.encoding == XA_STRING)
-		strncpy(text, (char *)name.value, size - 1);
-	else {
-		if (XmbTextPropertyToTextList(dpy, &name, &list, &n)
-                >= Success && n > 0 && *list) {
-			strncpy(text, *list, size - 1);
-			XFreeStringList(list);
-		}
-	}
-	text[size - 1] = '\0';
+	copytextprop(&name, text, size);
 	XFree(name.value);
 	return 1;
 }
@@ -2010,6 +2514,55 @@ incrovgaps(const Arg *arg)
 		selmon->gappih, selmon->gappiv);
 }
 
+void
+indexproc(pid_t pid, pid_t ppid, unsigned long long start)
+{
+	ProcSlot *s;
+	unsigned long long pstart;
+
+	if (2 * (procsused + 1) > procssize)
+		rehashprocs();
+	s = procslot(ppid);
+	pstart = s->pid == ppid && s->ppid >= 0 ? s->start : 0;
+	s = procslot(pid);
+	if (!s->pid)
+		procsused++;
+	s->pid = pid;
+	s->ppid = ppid;
+	s->start = start;
+	s->pstart = pstart;
+}
+
+void
+indexterm(Client *c)
+{
+	TermSlot *s;
+
+	if (2 * (termsused + 1) > termssize)
+		rehashterms();
+	s = termslot(c->pid);
+	if (!s->pid)
+		termsused++;
+	s->pid = c->pid;
+	s->n++;
+	s->c = c;
+}
+
+void
+indexwin(Window w, Client *c, int swallowed)
+{
+	WinSlot *s;
+
+	if (2 * (winsused + 1) > winssize)
+		rehashwins();
+	s = winslot(w);
+	if (s->win == None)
+		winsused++;
+	s->win = w;
+	s->c = c;
+	s->swallowed = swallowed;
+}
+
 void
 inplacerotate(const Arg *arg)
 {
@@ -2076,12 +2629,19 @@ insertclient(Client *item, Client *insertItem, int after)
 	c->next = insertItem;
 }
 
-int
-isdescprocess(pid_t p, pid_t c)
+Atom
+internreply(xcb_intern_atom_cookie_t ck)
 {
-        while (p != c && c != 0) c = getparentprocess(c);
+	Atom atom = None;
+	xcb_generic_error_t *e = NULL;
+	xcb_intern_atom_reply_t *r = xcb_intern_atom_reply(xcon, ck, &e);
 
-	return (int)c;
+	free(e);
+	if (r) {
+		atom = r->atom;
+		free(r);
+	}
+	return atom;
 }
 
 #ifdef XINERAMA
@@ -2123,24 +2683,57 @@ killclient(const Arg *arg)
 		XSetErrorHandler(xerrordummy);
 		XSetCloseDownMode(dpy, DestroyAll);
 		XKillClient(dpy, selmon->sel->win);
-		XSync(dpy, 0);
+		xsync();
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
 }
 
+pid_t
+lockholder(void)
+{
+	struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+	int fd;
+
+	if ((fd = open(DWMBLOCKSLOCKFILE, O_RDONLY | O_CLOEXEC)) == -1)
+		return 0;
+	if (fcntl(fd, F_GETLK, &fl) == -1 || fl.l_type == F_UNLCK)
+		fl.l_pid = 0;
+	close(fd);
+	return fl.l_pid;
+}
+
 void
 manage(Window w, XWindowAttributes *wa)
 {
-	Client *c, *t = NULL, *term = NULL;
-	Window trans = None;
+	Client *c, *t = NULL;
+	Window trans;
 	XWindowChanges wc;
 	XEvent xev;
+	Atom state;
+	xcb_res_query_client_ids_cookie_t pidck;
+	xcb_get_property_cookie_t ck[PropLast];
+	xcb_get_property_reply_t *props[PropLast];
+	unsigned int i;
+	unsigned long long start = clockns();
+
+	/* send every request before waiting on any reply, the pid is only
+	 * needed for swallowing and is picked up once the window is shown */
+	if (xres)
+		pidck = querypid(w);
+	requestprops(w, ck);
 
 	c = ecalloc(1, sizeof(Client));
 	c->cfact = 1.0;
 	c->win = w;
-	c->pid = winpid(w);
+	for (i = 0; i < PropLast; i++)
+		props[i] = propreply(ck[i]);
+	c->pid = propvalue(props[PropPid], XA_CARDINAL); /* unless XRes knows better */
+	if (xres) {
+		c->pidck = pidck;
+		c->pidquery = 1;
+		npidqueries++;
+	}
 	/* geometry */
 	c->x = c->oldx = wa->x;
 	c->y = c->oldy = wa->y;
@@ -2149,16 +2742,17 @@ manage(Window w, XWindowAttributes *wa)
 	c->oldbw = wa->border_width;
 	c->ignoresizehints = 0;
 
-	updatetitle(c);
+	settitle(c, props[PropNetWMName], props[PropWMName]);
 	c->bw = borderpx;
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+	trans = propvalue(props[PropTransient], XA_WINDOW);
+	if (trans != None && (t = wintoclient(trans))) {
 		c->mon = t->mon;
 		c->tags = t->tags;
 		c->alwaysontop = 1;
+		c->noswallow = 1;
 	} else {
 		c->mon = selmon;
-		applyrules(c);
-		term = termforwin(c);
+		applyrules(c, props);
 	}
 
 	if (c->x + WIDTH(c) > c->mon->mx + c->mon->mw)
@@ -2176,13 +2770,16 @@ manage(Window w, XWindowAttributes *wa)
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
         XSetWindowBorder(dpy, w, scheme[SchemeNorm][ColBorder].pixel);
 	configure(c); /* propagates border_width, if size doesn't change */
-	if (getatomprop(c, netatom[NetWMState]) == netatom[NetWMStateAbove])
+	state = propvalue(props[PropState], XA_ATOM);
+	if (state == netatom[NetWMStateAbove])
 		c->alwaysontop = 1;
-	if (getatomprop(c, netatom[NetWMState]) == netatom[NetWMFullscreen])
+	if (state == netatom[NetWMFullscreen])
 		setfullscreen(c, 1);
-	updatesizehints(c);
-	updatewmhints(c);
-	updatemotifhints(c);
+	setsizehints(c, props[PropNormalHints]);
+	setwmhints(c, props[PropHints]);
+	setmotifhints(c, props[PropMotif]);
+	for (i = 0; i < PropLast; i++)
+		free(props[i]);
         if (((c->isfloating && !c->isfullscreen) || c->isfixed
                 || !c->mon->lt[c->mon->sellt]->arrange) && !c->isfloatpos)
                 setfloatpos(c, "50% 50%");
@@ -2205,15 +2802,10 @@ manage(Window w, XWindowAttributes *wa)
         }
 	attachbelow(c);
 	attachstack(c);
-	XChangeProperty(dpy, root, netatom[NetClientList],
-                XA_WINDOW, 32, PropModeAppend,
-		(unsigned char *) &(c->win), 1);
-	XChangeProperty(dpy, root, netatom[NetClientListStacking],
-                        XA_WINDOW, 32, PropModePrepend,
-                        (unsigned char *) &(c->win), 1);
-        Atom target = XInternAtom(dpy, "_IS_FLOATING", 0);
+	indexwin(c->win, c, 0);
+	updateclientlist();
 	unsigned int floating[1] = {c->isfloating};
-	XChangeProperty(dpy, c->win, target,
+	XChangeProperty(dpy, c->win, floatingatom,
                         XA_CARDINAL, 32, PropModeReplace,
                         (unsigned char *)floating, 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
@@ -2222,12 +2814,41 @@ manage(Window w, XWindowAttributes *wa)
 		unfocus(selmon->sel, 0);
 	c->mon->sel = c;
 	arrange(c->mon);
-	XMapWindow(dpy, c->win);
-	if (term)
-		swallow(term, c);
+	mapclient(c);
+	PROBE5(manage, w, c->x, c->y, c->w, c->h);
+	if (!c->pidquery)
+		managepid(c);
 
 	focus(NULL);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &xev));
+	tally(&stats[StatManage], start);
+}
+
+/* the part of manage() that needs c's pid, returns whether c was
+ * swallowed */
+int
+managepid(Client *c)
+{
+	Client *term;
+
+	if (c->isterminal && c->pid)
+		indexterm(c);
+	else if (!c->noswallow && (term = termforwin(c))) {
+		swallow(term, c);
+		return 1;
+	}
+	return 0;
+}
+
+/* while deferring c is not arranged yet, mapping it now would show it at
+ * its initial geometry first */
+void
+mapclient(Client *c)
+{
+	if (deferring)
+		c->unmapped = mapspending = 1;
+	else
+		XMapWindow(dpy, c->win);
 }
 
 void
@@ -2262,6 +2883,7 @@ monocle(Monitor *m)
 	Client *c;
 
         getgaps(m, &oh, &ov, &ih, &iv, &n);
+        PROBE2(monocle, m->num, n);
 
 	if (n > 0) /* override layout symbol */
 		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", n);
@@ -2306,20 +2928,31 @@ movemouse(const Arg *arg)
 	Monitor *m;
 	XEvent ev;
 	Time lasttime = 0;
+	int defer = deferring, pace = pacing;
 
 	if (!(c = selmon->sel))
 		return;
 	if (c->isfullscreen) /* no support moving fullscreen windows by mouse */
 		return;
+	/* the pointer grab runs its own event loop, which must see its
+	 * effects immediately */
+	deferring = pacing = 0;
+	flushmons();
 	restack(selmon);
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, 0, MOUSEMASK, GrabModeAsync, GrabModeAsync,
 	                None, cursor[CurMove]->cursor, CurrentTime)
-        != GrabSuccess)
+        != GrabSuccess) {
+		deferring = defer;
+		pacing = pace;
 		return;
-	if (!getrootptr(&x, &y))
+	}
+	if (!getrootptr(&x, &y)) {
+		deferring = defer;
+		pacing = pace;
 		return;
+	}
 	do {
 		XMaskEvent(dpy,
                         MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
@@ -2347,11 +2980,13 @@ movemouse(const Arg *arg)
                                         - (ny + HEIGHT(c)))
                         < snap)
 				ny = selmon->wy + selmon->wh - HEIGHT(c);
+			beginresize();
 			if (!c->isfloating && selmon->lt[selmon->sellt]->arrange
 			&& (abs(nx - c->x) > snap || abs(ny - c->y) > snap))
 				togglefloating(NULL);
 			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
 				resize(c, nx, ny, c->w, c->h, 1);
+			endresize();
 			break;
 		}
 	} while (ev.type != ButtonRelease);
@@ -2361,6 +2996,8 @@ movemouse(const Arg *arg)
 		selmon = m;
 		focus(NULL);
 	}
+	deferring = defer;
+	pacing = pace;
 }
 
 Client *
@@ -2378,6 +3015,17 @@ nexttiled(Client *c)
 	return c;
 }
 
+unsigned int
+pidhash(pid_t pid)
+{
+	unsigned int h = pid;
+
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h;
+}
+
 void
 pop(Client *c)
 {
@@ -2387,6 +3035,34 @@ pop(Client *c)
 	arrange(c->mon);
 }
 
+void
+printstat(const char *name, const Stat *s)
+{
+	unsigned int i;
+
+	fprintf(stderr, "dwm: %-16s %8lu %10llu ", name, s->calls, s->ns / 1000);
+	for (i = 0; i < LENGTH(s->hist); i++)
+		if (s->hist[i])
+			fprintf(stderr, " %u:%lu", i, s->hist[i]);
+	fputc('\n', stderr);
+}
+
+/* returns the slot holding pid, or the one it would be stored in */
+ProcSlot *
+procslot(pid_t pid)
+{
+	unsigned int i, mask = procssize - 1;
+	ProcSlot *removed = NULL;
+
+	for (i = pidhash(pid) & mask; procs[i].pid; i = (i + 1) & mask) {
+		if (procs[i].pid == pid && procs[i].ppid >= 0)
+			return &procs[i];
+		if (procs[i].ppid < 0 && !removed)
+			removed = &procs[i];
+	}
+	return removed ? removed : &procs[i];
+}
+
 void
 propertynotify(XEvent *e)
 {
@@ -2394,8 +3070,15 @@ propertynotify(XEvent *e)
 	Window trans;
 	XPropertyEvent *ev = &e->xproperty;
 
-	if ((ev->window == root) && (ev->atom == XA_WM_NAME))
+	if ((ev->window == root) && (ev->atom == XA_WM_NAME)) {
+		/* whoever sets the name now takes over from the socket, its
+		 * producer may be gone */
+		if (slotstatus) {
+			slotstatus = 0;
+			memset(statusslots, 0, sizeof statusslots);
+		}
 		updatestatus();
+	}
 	else if (ev->state == PropertyDelete)
 		return; /* ignore */
 	else if ((c = wintoclient(ev->window))) {
@@ -2425,41 +3108,336 @@ propertynotify(XEvent *e)
 	}
 }
 
-void
-quit(const Arg *arg)
+xcb_get_property_reply_t *
+propreply(xcb_get_property_cookie_t ck)
 {
-	running = 0;
+	xcb_generic_error_t *e = NULL;
+	xcb_get_property_reply_t *r;
+
+	r = xcb_get_property_reply(xcon, ck, &e);
+	free(e);
+	if (r && r->type == None) {
+		free(r);
+		r = NULL;
+	}
+	return r;
 }
 
-Monitor *
-recttomon(int x, int y, int w, int h)
+int
+proptext(xcb_get_property_reply_t *r, char *text, unsigned int size)
 {
-	Monitor *m, *r = selmon;
-	int a, area = 0;
+	XTextProperty name;
 
-	for (m = mons; m; m = m->next)
-		if ((a = INTERSECT(x, y, w, h, m)) > area) {
-			area = a;
-			r = m;
-		}
-	return r;
+	text[0] = '\0';
+	if (!r || !r->value_len)
+		return 0;
+	name.value = xcb_get_property_value(r);
+	name.encoding = r->type;
+	name.format = r->format;
+	name.nitems = r->value_len;
+	copytextprop(&name, text, size);
+	return 1;
 }
 
-void
-resetfact(const Arg *arg)
+unsigned long
+propvalue(xcb_get_property_reply_t *r, Atom type)
 {
-        Client *c;
-
-	selmon->pertag->mfacts[selmon->pertag->curtag] = mfact;
-	selmon->mfact = selmon->pertag->mfacts[selmon->pertag->curtag];
-        for (c = nexttiled(selmon->clients); c; c = nexttiled(c->next)) {
-                c->cfact = 1.0;
-        }
-        setgaps(gappoh, gappov, gappih, gappiv);
+	if (!r || r->type != type || r->format != 32 || !r->value_len)
+		return 0;
+	return *(uint32_t *)xcb_get_property_value(r);
 }
 
-void
-resize(Client *c, int x, int y, int w, int h, int interact)
+/* async-signal-safe number formatting for writetrace() */
+char *
+putnum(char *p, unsigned long long n, unsigned int base)
+{
+	char digits[24];
+	unsigned int i = 0;
+
+	do
+		digits[i++] = "0123456789abcdef"[n % base];
+	while ((n /= base));
+	while (i)
+		*p++ = digits[--i];
+	return p;
+}
+
+/* stpcpy() is not async-signal-safe either */
+char *
+putstr(char *p, const char *s)
+{
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+xcb_res_query_client_ids_cookie_t
+querypid(Window w)
+{
+	xcb_res_client_id_spec_t spec = {0};
+
+	spec.client = w;
+	spec.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID;
+	return xcb_res_query_client_ids(xcon, 1, &spec);
+}
+
+void
+quit(const Arg *arg)
+{
+	running = 0;
+}
+
+/* forget the dwmblocks pid whenever its lock file is written, replaced or
+ * removed, dwmblocks closes it on exit */
+void
+readblockswatch(void)
+{
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ie;
+	ssize_t n;
+	char *p;
+
+	while ((n = read(blocksfd, buf, sizeof buf)) > 0)
+		for (p = buf; p < buf + n; p += sizeof *ie + ie->len) {
+			ie = (const struct inotify_event *)p;
+			if (!ie->len || !strcmp(ie->name,
+			    DWMBLOCKSLOCKFILE + sizeof DWMBLOCKSLOCKDIR))
+				blockspid = 0;
+			if (ie->mask & IN_IGNORED) { /* the directory is gone */
+				close(blocksfd);
+				blocksfd = -1;
+				return;
+			}
+		}
+}
+
+pid_t
+readppid(pid_t p, unsigned long long *start)
+{
+	int v = 0;
+	FILE *f;
+	char buf[512], *s;
+	snprintf(buf, sizeof(buf) - 1, "/proc/%u/stat", (unsigned)p);
+
+	if (!(f = fopen(buf, "r"))) return 0;
+
+	/* the command name may contain spaces and parentheses */
+	*start = 0;
+	if (fgets(buf, sizeof buf, f) && (s = strrchr(buf, ')')))
+		sscanf(s + 1, " %*c %d %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+		       "%*s %*s %*s %*s %*s %*s %*s %*s %llu", &v, start);
+	fclose(f);
+	return (pid_t)v;
+}
+
+void
+readprocevents(void)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct nlmsghdr))));
+	struct nlmsghdr *nh;
+	struct proc_event *ev;
+	struct timespec boot;
+	unsigned long long suspended;
+	ssize_t n;
+
+	/* fork times are taken from the monotonic clock, /proc start times
+	 * from the boot time clock that also counts suspended time */
+	clock_gettime(CLOCK_BOOTTIME, &boot);
+	suspended = boot.tv_sec * 1000000000ULL + boot.tv_nsec - clockns();
+	while ((n = recv(procfd, buf, sizeof buf, 0)) > 0
+	|| (n < 0 && errno == ENOBUFS)) {
+		if (n < 0) { /* events were dropped, start over */
+			scanprocs();
+			continue;
+		}
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, n);
+		     nh = NLMSG_NEXT(nh, n)) {
+			if (nh->nlmsg_type != NLMSG_DONE)
+				continue;
+			ev = (struct proc_event *)((struct cn_msg *)NLMSG_DATA(nh))->data;
+			/* threads come and go under their process' pid */
+			if (ev->what == PROC_EVENT_FORK
+			&& ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+				indexproc(ev->event_data.fork.child_tgid,
+				          ev->event_data.fork.parent_tgid,
+				          (ev->timestamp_ns + suspended) / nsperclk);
+			else if (ev->what == PROC_EVENT_EXIT
+			&& ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+				unindexproc(ev->event_data.exit.process_tgid);
+		}
+	}
+}
+
+void
+readsignals(void)
+{
+	struct signalfd_siginfo si;
+
+	while (read(sigfd, &si, sizeof si) == sizeof si) {
+		switch (si.ssi_signo) {
+		case SIGCHLD:
+			while (0 < waitpid(-1, NULL, WNOHANG));
+			break;
+		case SIGUSR1:
+			dumpstats();
+			break;
+		case SIGUSR2:
+			writetrace();
+			break;
+		case SIGTERM:
+			running = 0;
+			break;
+		}
+	}
+}
+
+void
+readstatus(void)
+{
+	char buf[STATUSLENGTH + 1], status[STATUSLENGTH];
+	ssize_t n;
+	size_t len, used = 0;
+	unsigned int i, got = 0;
+
+	/* each datagram is a block id byte followed by its new text */
+	while ((n = recv(statusfd, buf, sizeof buf, 0)) >= 0) {
+		if (n < 1 || (unsigned char)buf[0] >= STATUSSLOTS)
+			continue;
+		len = MIN((size_t)n - 1, STATUSLENGTH - 1);
+		memcpy(statusslots[(unsigned char)buf[0]], buf + 1, len);
+		statusslots[(unsigned char)buf[0]][len] = '\0';
+		got = 1;
+	}
+	if (!got)
+		return;
+	slotstatus = 1;
+	for (i = 0; i < STATUSSLOTS; i++) {
+		len = MIN(strlen(statusslots[i]), sizeof status - 1 - used);
+		memcpy(status + used, statusslots[i], len);
+		used += len;
+	}
+	status[used] = '\0';
+	setstatus(status);
+}
+
+void
+rehashprocs(void)
+{
+	ProcSlot *old = procs, *s;
+	unsigned int i, n = procssize, live = 0;
+
+	for (i = 0; i < n; i++)
+		if (old[i].pid && old[i].ppid >= 0)
+			live++;
+	/* drop exited processes and keep the table at most a quarter full */
+	for (procssize = 256; procssize < 4 * (live + 1); procssize *= 2);
+	procs = ecalloc(procssize, sizeof(ProcSlot));
+	procsused = 0;
+	for (i = 0; i < n; i++)
+		if (old[i].pid && old[i].ppid >= 0) {
+			s = procslot(old[i].pid);
+			*s = old[i];
+			procsused++;
+		}
+	free(old);
+}
+
+void
+rehashwins(void)
+{
+	WinSlot *old = wins, *s;
+	unsigned int i, n = winssize, live = 0;
+
+	for (i = 0; i < n; i++)
+		if (old[i].c)
+			live++;
+	/* drop removed slots and keep the table at most a quarter full */
+	for (winssize = 16; winssize < 4 * (live + 1); winssize *= 2);
+	wins = ecalloc(winssize, sizeof(WinSlot));
+	winsused = 0;
+	for (i = 0; i < n; i++)
+		if (old[i].c) {
+			s = winslot(old[i].win);
+			*s = old[i];
+			winsused++;
+		}
+	free(old);
+}
+
+void
+rehashterms(void)
+{
+	TermSlot *old = terms, *s;
+	unsigned int i, n = termssize, live = 0;
+
+	for (i = 0; i < n; i++)
+		if (old[i].n)
+			live++;
+	for (termssize = 16; termssize < 4 * (live + 1); termssize *= 2);
+	terms = ecalloc(termssize, sizeof(TermSlot));
+	termsused = 0;
+	for (i = 0; i < n; i++)
+		if (old[i].n) {
+			s = termslot(old[i].pid);
+			*s = old[i];
+			termsused++;
+		}
+	free(old);
+}
+
+Monitor *
+recttomon(int x, int y, int w, int h)
+{
+	Monitor *m, *r = selmon;
+	int a, area = 0;
+
+	for (m = mons; m; m = m->next)
+		if ((a = INTERSECT(x, y, w, h, m)) > area) {
+			area = a;
+			r = m;
+		}
+	return r;
+}
+
+void
+requestprops(Window w, xcb_get_property_cookie_t *ck)
+{
+	unsigned int i;
+	Atom props[PropLast] = {
+		[PropNetWMName] = netatom[NetWMName],
+		[PropWMName] = XA_WM_NAME,
+		[PropTransient] = XA_WM_TRANSIENT_FOR,
+		[PropClass] = XA_WM_CLASS,
+		[PropRole] = wmatom[WMWindowRole],
+		[PropState] = netatom[NetWMState],
+		[PropWindowType] = netatom[NetWMWindowType],
+		[PropNormalHints] = XA_WM_NORMAL_HINTS,
+		[PropHints] = XA_WM_HINTS,
+		[PropMotif] = motifatom,
+		[PropPid] = netatom[NetWMPid],
+	};
+
+	for (i = 0; i < PropLast; i++)
+		ck[i] = xcb_get_property(xcon, 0, w, props[i],
+                                XCB_GET_PROPERTY_TYPE_ANY, 0, PROPLENGTH);
+}
+
+void
+resetfact(const Arg *arg)
+{
+        Client *c;
+
+	selmon->pertag->mfacts[selmon->pertag->curtag] = mfact;
+	selmon->mfact = selmon->pertag->mfacts[selmon->pertag->curtag];
+        for (c = nexttiled(selmon->clients); c; c = nexttiled(c->next)) {
+                c->cfact = 1.0;
+        }
+        setgaps(gappoh, gappov, gappih, gappiv);
+}
+
+void
+resize(Client *c, int x, int y, int w, int h, int interact)
 {
 	if (applysizehints(c, &x, &y, &w, &h, interact))
 		resizeclient(c, x, y, w, h);
@@ -2470,6 +3448,7 @@ resizeclient(Client *c, int x, int y, int w, int h)
 {
 	XWindowChanges wc;
 
+	PROBE5(resizeclient, c->win, x, y, w, h);
 	c->oldx = c->x; c->x = wc.x = x;
 	c->oldy = c->y; c->y = wc.y = y;
 	c->oldw = c->w; c->w = wc.width = w;
@@ -2478,7 +3457,8 @@ resizeclient(Client *c, int x, int y, int w, int h)
 	XConfigureWindow(dpy, c->win,
                         CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
 	configure(c);
-	XSync(dpy, 0);
+	if (!resizing)
+		xsync();
 }
 
 void
@@ -2492,26 +3472,36 @@ resizemouse(const Arg *arg)
 	unsigned int dui;
 	Window w;
 	Time lasttime = 0;
+	int defer = deferring, pace = pacing;
 
 	if (!(c = selmon->sel))
 		return;
 	if (c->isfullscreen) /* no support resizing fullscreen windows by mouse */
 		return;
+	/* see movemouse() */
+	deferring = pacing = 0;
+	flushmons();
 	restack(selmon);
 	ocx = c->x;
 	ocy = c->y;
 	och = c->h;
 	ocw = c->w;
-	if (!XQueryPointer(dpy, c->win, &w, &w, &opx, &opy, &nx, &ny, &dui))
+	if (!XQueryPointer(dpy, c->win, &w, &w, &opx, &opy, &nx, &ny, &dui)) {
+		deferring = defer;
+		pacing = pace;
 		return;
+	}
 	horizcorner = nx < c->w / 2;
 	vertcorner  = ny < c->h / 2;
 	if (XGrabPointer(dpy, root, 0,
                         MOUSEMASK, GrabModeAsync, GrabModeAsync,
                         None, cursor[horizcorner | (vertcorner << 1)]->cursor,
                         CurrentTime)
-        != GrabSuccess)
+        != GrabSuccess) {
+		deferring = defer;
+		pacing = pace;
 		return;
+	}
 	do {
 		XMaskEvent(dpy,
                         MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
@@ -2534,6 +3524,7 @@ resizemouse(const Arg *arg)
 			nh = MAX( vertcorner
                                 ? (ocy + och - ny)
                                 : (och + (ev.xmotion.y - opy)), 1);
+			beginresize();
 			if (c->mon->wx + nw >= selmon->wx
                         && c->mon->wx + nw <= selmon->wx + selmon->ww
 			&& c->mon->wy + nh >= selmon->wy
@@ -2547,6 +3538,7 @@ resizemouse(const Arg *arg)
 			}
 			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
 				resizeclient(c, nx, ny, nw, nh);
+			endresize();
 			break;
 		}
 	} while (ev.type != ButtonRelease);
@@ -2557,6 +3549,39 @@ resizemouse(const Arg *arg)
 		selmon = m;
 		focus(NULL);
 	}
+	deferring = defer;
+	pacing = pace;
+}
+
+/* pick up the XRes replies that have arrived so far, returns their number */
+int
+resolvepids(void)
+{
+	Monitor *m;
+	Client *c, *next;
+	void *r;
+	xcb_generic_error_t *e;
+	pid_t pid;
+	int n = 0, swallowed = 0;
+
+	for (m = mons; m && npidqueries; m = m->next)
+		for (c = m->clients; c && npidqueries; c = next) {
+			next = c->next; /* c may get swallowed */
+			if (!c->pidquery || !xcb_poll_for_reply(xcon,
+			    c->pidck.sequence, &r, &e))
+				continue;
+			c->pidquery = 0;
+			npidqueries--;
+			n++;
+			if ((pid = winpid(r)))
+				c->pid = pid;
+			free(r);
+			free(e);
+			swallowed |= managepid(c);
+		}
+	if (swallowed)
+		focus(NULL);
+	return n;
 }
 
 void
@@ -2566,6 +3591,10 @@ restack(Monitor *m)
 	XEvent ev;
 	XWindowChanges wc;
 
+	if (deferring) {
+		m->dirty |= DirtyRestack;
+		return;
+	}
 	drawbar(m);
 	if (!m->sel) return;
 	if (m->sel->isfloating || !m->lt[m->sellt]->arrange)
@@ -2580,19 +3609,96 @@ restack(Monitor *m)
 				wc.sibling = c->win;
 			}
 	}
-	XSync(dpy, 0);
+	xsync();
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
 void
 run(void)
 {
+	static void (*fdhandler[FdLast])(void) = {
+		[FdStatus] = readstatus,
+		[FdFrame] = drawframe,
+		[FdSignal] = readsignals,
+		[FdBlocks] = readblockswatch,
+		[FdProc] = readprocevents,
+	};
+	struct epoll_event events[FdLast];
 	XEvent ev;
+	unsigned int n;
+	int i, nevents, resolved;
+	unsigned long long t;
+
 	/* main event loop */
 	XSync(dpy, 0);
-	while (running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
+	pacing = 1;
+	while (running) {
+		/* drain what is already queued before arranging, so a burst
+		 * of events settles in a single step */
+		deferring = batchsize > 1;
+		for (n = 0; running && n < batchsize && XPending(dpy); n++) {
+			XNextEvent(dpy, &ev);
+			if (handler[ev.type]) {
+				t = clockns();
+				trace('B', ev.type, ev.xany.window, t);
+				PROBE2(handler__entry, ev.type, ev.xany.window);
+				handler[ev.type](&ev); /* call handler */
+				PROBE2(handler__return, ev.type, ev.xany.window);
+				trace('E', ev.type, ev.xany.window,
+				      tally(&evstats[ev.type], t));
+			}
+		}
+		/* XPending and the handlers read pid replies as well, epoll
+		 * does not see those */
+		resolved = npidqueries ? resolvepids() : 0;
+		deferring = 0;
+		if (n || resolved) {
+			flushmons();
+			updateclientlist();
+		}
+		if (!running)
+			break;
+		/* only sleep when the last XPending found nothing to do.
+		 * Otherwise just look at the other sources so a steady stream
+		 * of X events cannot starve them */
+		nevents = epoll_wait(epfd, events, LENGTH(events),
+		                     n || resolved ? 0 : -1);
+		if (nevents < 0 && errno != EINTR)
+			die("epoll_wait:");
+		for (i = 0; i < nevents; i++)
+			if (fdhandler[events[i].data.u32])
+				fdhandler[events[i].data.u32]();
+	}
+}
+
+/* $XDG_RUNTIME_DIR, or a private directory when it is unset */
+const char *
+runtimedir(void)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	if (!rundir[0]) {
+		if (dir && *dir && strlen(dir) < sizeof rundir)
+			strcpy(rundir, dir);
+		else if (mkdtemp(strcpy(rundir, "/tmp/dwm-XXXXXX"))) {
+			ownrundir = 1;
+			setenv("DWM_RUNTIME_DIR", rundir, 1);
+		} else
+			rundir[0] = '\0';
+	}
+	return rundir[0] ? rundir : NULL;
+}
+
+/* whether a and b look the same, the key alone may collide */
+int
+samesegment(const Segment *a, const Segment *b)
+{
+	if (a->key != b->key || a->scheme != b->scheme || a->pad != b->pad
+	|| a->flags != b->flags)
+		return 0;
+	if (!a->text || !b->text)
+		return a->text == b->text;
+	return !strcmp(a->text, b->text);
 }
 
 void
@@ -2625,6 +3731,36 @@ scan(void)
 	}
 }
 
+/* seed procs from /proc, also used when proc events were lost */
+void
+scanprocs(void)
+{
+	DIR *d;
+	struct dirent *e;
+	pid_t pid, ppid;
+	unsigned long long start;
+	unsigned int i;
+	ProcSlot *p;
+	char *end;
+
+	if (procs)
+		memset(procs, 0, procssize * sizeof(ProcSlot));
+	procsused = 0;
+	if (!(d = opendir("/proc")))
+		return;
+	while ((e = readdir(d)))
+		if ((pid = strtol(e->d_name, &end, 10)) > 0 && !*end
+		&& (ppid = readppid(pid, &start)))
+			indexproc(pid, ppid, start);
+	closedir(d);
+	/* children may have been read before their parents */
+	for (i = 0; i < procssize; i++)
+		if (procs[i].ppid > 0 && !procs[i].pstart
+		&& (p = procslot(procs[i].ppid))->pid == procs[i].ppid
+		&& p->ppid >= 0)
+			procs[i].pstart = p->start;
+}
+
 void
 sendmon(Client *c, Monitor *m)
 {
@@ -2874,6 +4010,32 @@ setmfact(const Arg *arg)
 	arrange(selmon);
 }
 
+void
+setmotifhints(Client *c, xcb_get_property_reply_t *r)
+{
+	uint32_t *motif;
+	int width, height;
+
+	if (!decorhints || !r || r->type != motifatom || r->format != 32
+	|| r->value_len <= MWM_HINTS_DECORATIONS_FIELD)
+		return;
+	motif = xcb_get_property_value(r);
+	if (motif[MWM_HINTS_FLAGS_FIELD] & MWM_HINTS_DECORATIONS) {
+		width = WIDTH(c);
+		height = HEIGHT(c);
+
+		if (motif[MWM_HINTS_DECORATIONS_FIELD] & MWM_DECOR_ALL
+                || motif[MWM_HINTS_DECORATIONS_FIELD] & MWM_DECOR_BORDER
+                || motif[MWM_HINTS_DECORATIONS_FIELD] & MWM_DECOR_TITLE)
+			c->bw = c->oldbw = borderpx;
+		else
+			c->bw = c->oldbw = 0;
+
+		resize( c, c->x, c->y,
+                        width - (2*c->bw), height - (2*c->bw), 0);
+	}
+}
+
 void
 setnumdesktops(void)
 {
@@ -2884,57 +4046,214 @@ setnumdesktops(void)
 }
 
 
+void
+setsizehints(Client *c, xcb_get_property_reply_t *r)
+{
+	int32_t *v;
+	XSizeHints size = { .flags = PSize };
+
+	/* decoded as XGetWMNormalHints() would, old 15 element form included */
+	if (r && r->type == XA_WM_SIZE_HINTS && r->format == 32
+	&& r->value_len >= 15) {
+		v = xcb_get_property_value(r);
+		size.flags = v[0];
+		size.min_width = v[5];
+		size.min_height = v[6];
+		size.max_width = v[7];
+		size.max_height = v[8];
+		size.width_inc = v[9];
+		size.height_inc = v[10];
+		size.min_aspect.x = v[11];
+		size.min_aspect.y = v[12];
+		size.max_aspect.x = v[13];
+		size.max_aspect.y = v[14];
+		if (r->value_len >= 18) {
+			size.base_width = v[15];
+			size.base_height = v[16];
+			size.win_gravity = v[17];
+		} else
+			size.flags &= ~(PBaseSize|PWinGravity);
+	}
+	if (size.flags & PBaseSize) {
+		c->basew = size.base_width;
+		c->baseh = size.base_height;
+	} else if (size.flags & PMinSize) {
+		c->basew = size.min_width;
+		c->baseh = size.min_height;
+	} else
+		c->basew = c->baseh = 0;
+	if (size.flags & PResizeInc) {
+		c->incw = size.width_inc;
+		c->inch = size.height_inc;
+	} else
+		c->incw = c->inch = 0;
+	if (size.flags & PMaxSize) {
+		c->maxw = size.max_width;
+		c->maxh = size.max_height;
+	} else
+		c->maxw = c->maxh = 0;
+	if (size.flags & PMinSize) {
+		c->minw = size.min_width;
+		c->minh = size.min_height;
+	} else if (size.flags & PBaseSize) {
+		c->minw = size.base_width;
+		c->minh = size.base_height;
+	} else
+		c->minw = c->minh = 0;
+	if (size.flags & PAspect) {
+		c->mina = (float)size.min_aspect.y / size.min_aspect.x;
+		c->maxa = (float)size.max_aspect.x / size.max_aspect.y;
+	} else
+		c->maxa = c->mina = 0.0;
+	c->isfixed = (c->maxw && c->maxh
+                        && c->maxw == c->minw
+                        && c->maxh == c->minh);
+}
+
+void
+settitle(Client *c, xcb_get_property_reply_t *netname,
+        xcb_get_property_reply_t *name)
+{
+	if (!proptext(netname, c->name, sizeof c->name))
+		proptext(name, c->name, sizeof c->name);
+	if (c->name[0] == '\0') /* hack to mark broken clients */
+		strcpy(c->name, broken);
+}
+
+void
+setstatus(const char *rawstext)
+{
+	char text[STATUSLENGTH], *t = text;
+	const char *rst;
+	Block parsed[LENGTH(blocks)], *b;
+	unsigned int i, n = 0, start = 0;
+	int scm = SchemeBar, changed;
+
+	/* split at every delimiter and colour byte, a colour applies to the
+	 * blocks after it */
+	for (rst = rawstext;; rst++) {
+		if ((unsigned char)*rst >= ' ') {
+			*t++ = *rst;
+			continue;
+		}
+		if (*rst && n == LENGTH(parsed) - 1)
+			continue; /* the last block takes the rest */
+		*t++ = '\0';
+		b = &parsed[n++];
+		b->off = start;
+		b->scheme = scm;
+		b->end = *rst;
+		b->hash = fnv1a(FNV1A_INIT, text + start, t - text - start - 1);
+		if (*rst == '\0')
+			break;
+		if ((unsigned char)*rst > DELIMITERENDCHAR
+		&& *rst - DELIMITERENDCHAR - 1 < LENGTH(colors))
+			scm = *rst - DELIMITERENDCHAR - 1;
+		start = t - text;
+	}
+
+	/* only measure the blocks that changed */
+	changed = n != nblocks;
+	wstext = LSPAD + RSPAD;
+	for (i = 0, b = parsed; i < n; i++, b++) {
+		if (i < nblocks && b->hash == blocks[i].hash
+		&& !strcmp(text + b->off, stext + blocks[i].off))
+			b->w = blocks[i].w;
+		else {
+			b->w = TTEXTW(text + b->off);
+			changed = 1;
+		}
+		if (i < nblocks && b->scheme != blocks[i].scheme)
+			changed = 1;
+		wstext += b->w;
+	}
+	memcpy(stext, text, t - text);
+	memcpy(blocks, parsed, n * sizeof(Block));
+	nblocks = n;
+	if (changed)
+		drawbar(selmon);
+}
+
 void
 setup(void)
 {
 	int i;
 	XSetWindowAttributes wa;
 	Atom utf8string;
-
+	const xcb_query_extension_reply_t *ext;
+	const struct { const char *name; Atom *atom; } atoms[] = {
+		{ "UTF8_STRING",               &utf8string },
+		{ "WM_PROTOCOLS",              &wmatom[WMProtocols] },
+		{ "WM_DELETE_WINDOW",          &wmatom[WMDelete] },
+		{ "WM_STATE",                  &wmatom[WMState] },
+		{ "WM_TAKE_FOCUS",             &wmatom[WMTakeFocus] },
+		{ "WM_WINDOW_ROLE",            &wmatom[WMWindowRole] },
+		{ "_NET_ACTIVE_WINDOW",        &netatom[NetActiveWindow] },
+		{ "_NET_SUPPORTED",            &netatom[NetSupported] },
+		{ "_NET_WM_NAME",              &netatom[NetWMName] },
+		{ "_NET_WM_PID",               &netatom[NetWMPid] },
+		{ "_NET_WM_STATE",             &netatom[NetWMState] },
+		{ "_NET_WM_STATE_ABOVE",       &netatom[NetWMStateAbove] },
+		{ "_NET_SUPPORTING_WM_CHECK",  &netatom[NetWMCheck] },
+		{ "_NET_WM_STATE_FULLSCREEN",  &netatom[NetWMFullscreen] },
+		{ "_NET_WM_WINDOW_TYPE",       &netatom[NetWMWindowType] },
+		{ "_NET_CLIENT_LIST",          &netatom[NetClientList] },
+		{ "_NET_CLIENT_LIST_STACKING", &netatom[NetClientListStacking] },
+		{ "_NET_DESKTOP_VIEWPORT",     &netatom[NetDesktopViewport] },
+		{ "_NET_NUMBER_OF_DESKTOPS",   &netatom[NetNumberOfDesktops] },
+		{ "_NET_CURRENT_DESKTOP",      &netatom[NetCurrentDesktop] },
+		{ "_NET_DESKTOP_NAMES",        &netatom[NetDesktopNames] },
+		{ "_MOTIF_WM_HINTS",           &motifatom },
+		{ "_IS_FLOATING",              &floatingatom },
+	};
+	xcb_intern_atom_cookie_t atomck[LENGTH(atoms)], typeck[LENGTH(rules)];
+
+	/* signals are read from a signalfd in the event loop instead of
+	 * being handled asynchronously */
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, SIGCHLD);
+	sigaddset(&sigmask, SIGUSR1);
+	sigaddset(&sigmask, SIGUSR2);
+	sigaddset(&sigmask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &sigmask, &origmask) < 0
+	|| (sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+		die("signalfd:");
 	/* clean up any zombies immediately */
-	sigchld(0);
+	while (0 < waitpid(-1, NULL, WNOHANG));
 
 	/* init screen */
 	screen = DefaultScreen(dpy);
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	drw = drw_create(dpy, screen, root, sw, sh);
+	/* only measures text, each bar draws into its monitor's own drw */
+	drw = drw_create(dpy, screen, root, 1, 1);
 	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
 		die("no fonts could be loaded.");
 	lrpad = drw->fonts->h;
+	for (i = 0; i < LENGTH(tags); i++) {
+		tagw[i] = TEXTW(tags[i]);
+		tagaltw[i] = TEXTW(tagsalt[i]);
+	}
 	bh = (barheight ? barheight : drw->fonts->h + 2) + barborder * 2;
 	bh = bargap ? bh : (bh - barborder * 2);
 	sp = bargap ? sidepad : 0;
 	vp = (topbar == 1) ? vertpad : - vertpad;
 	vp = bargap ? vp : 0;
 	updategeom();
-	/* init atoms */
-	utf8string = XInternAtom(dpy, "UTF8_STRING", 0);
-	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", 0);
-	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", 0);
-	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", 0);
-	wmatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", 0);
-	wmatom[WMWindowRole] = XInternAtom(dpy, "WM_WINDOW_ROLE", 0);
-	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", 0);
-	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", 0);
-	netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", 0);
-	netatom[NetWMState] = XInternAtom(dpy, "_NET_WM_STATE", 0);
-	netatom[NetWMStateAbove] = XInternAtom(dpy, "_NET_WM_STATE_ABOVE", 0);
-	netatom[NetWMCheck] = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", 0);
-	netatom[NetWMFullscreen] = XInternAtom(dpy,
-                                        "_NET_WM_STATE_FULLSCREEN", 0);
-	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", 0);
-	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", 0);
-	netatom[NetClientListStacking] = XInternAtom( dpy,
-                                                "_NET_CLIENT_LIST_STACKING", 0);
-	netatom[NetDesktopViewport] = XInternAtom(dpy,
-                                        "_NET_DESKTOP_VIEWPORT", 0);
-	netatom[NetNumberOfDesktops] = XInternAtom(dpy,
-                                        "_NET_NUMBER_OF_DESKTOPS", 0);
-	netatom[NetCurrentDesktop] = XInternAtom(dpy, "_NET_CURRENT_DESKTOP", 0);
-	netatom[NetDesktopNames] = XInternAtom(dpy, "_NET_DESKTOP_NAMES", 0);
-	motifatom = XInternAtom(dpy, "_MOTIF_WM_HINTS", 0);
+	/* init atoms, interning them all in a single round trip */
+	for (i = 0; i < LENGTH(atoms); i++)
+		atomck[i] = xcb_intern_atom(xcon, 0, strlen(atoms[i].name),
+                                atoms[i].name);
+	for (i = 0; i < LENGTH(rules); i++)
+		if (rules[i].wintype)
+			typeck[i] = xcb_intern_atom(xcon, 0,
+                                        strlen(rules[i].wintype), rules[i].wintype);
+	for (i = 0; i < LENGTH(atoms); i++)
+		*atoms[i].atom = internreply(atomck[i]);
+	for (i = 0; i < LENGTH(rules); i++)
+		if (rules[i].wintype)
+			ruletypes[i] = internreply(typeck[i]);
 	/* init cursors */
 	cursor[CurNormal] = drw_cur_create(drw, XC_left_ptr);
         cursor[CurHand] = drw_cur_create(drw, XC_hand2);
@@ -2950,6 +4269,32 @@ setup(void)
 	/* init bars */
 	updatebars();
 	updatestatus();
+	setupstatus();
+	setuptrace();
+	updateframerate();
+	if (barfps >= 0 && (barfd = timerfd_create(CLOCK_MONOTONIC,
+	    TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+		fprintf(stderr, "dwm: timerfd_create: %s\n", strerror(errno));
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		die("epoll_create1:");
+	watchfd(ConnectionNumber(dpy), FdX);
+	watchfd(statusfd, FdStatus);
+	watchfd(barfd, FdFrame);
+	watchfd(sigfd, FdSignal);
+	/* dwmblocks is optional, without its directory there is nothing to
+	 * watch */
+	if ((blocksfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0
+	&& inotify_add_watch(blocksfd, DWMBLOCKSLOCKDIR, IN_CLOSE_WRITE
+	    | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+	    | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+		close(blocksfd);
+		blocksfd = -1;
+	}
+	watchfd(blocksfd, FdBlocks);
+	setupprocs();
+	watchfd(procfd, FdProc);
+	/* without XRes, pids come from _NET_WM_PID only */
+	xres = (ext = xcb_get_extension_data(xcon, &xcb_res_id)) && ext->present;
 	updatebarpos(selmon);
 	/* supporting window for NetWMCheck */
 	wmcheckwin = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
@@ -2979,6 +4324,82 @@ setup(void)
 	focus(NULL);
 }
 
+/* listen to fork and exit events so ancestry checks need no /proc reads,
+ * binding the proc connector needs CAP_NET_ADMIN */
+void
+setupprocs(void)
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC };
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))]
+		__attribute__ ((aligned(__alignof__(struct nlmsghdr))));
+	struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+	struct cn_msg *cn = NLMSG_DATA(nh);
+	enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+
+	memset(buf, 0, sizeof buf);
+	nh->nlmsg_len = NLMSG_LENGTH(sizeof(*cn) + sizeof op);
+	nh->nlmsg_type = NLMSG_DONE;
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof op;
+	memcpy(cn->data, &op, sizeof op);
+	nsperclk = 1000000000ULL / sysconf(_SC_CLK_TCK);
+	if ((procfd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+	    NETLINK_CONNECTOR)) < 0
+	|| bind(procfd, (struct sockaddr *)&addr, sizeof addr) < 0
+	|| send(procfd, nh, nh->nlmsg_len, 0) < 0) {
+		fprintf(stderr, "dwm: no proc connector, swallowing reads /proc: %s\n",
+		        strerror(errno));
+		if (procfd >= 0)
+			close(procfd);
+		procfd = -1;
+		return;
+	}
+	/* subscribed first, so nothing forked during the scan is missed */
+	scanprocs();
+}
+
+void
+setupstatus(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const char *dir;
+	mode_t mask;
+
+	if (!(dir = runtimedir())
+	|| snprintf(addr.sun_path, sizeof addr.sun_path, "%s/dwm-status%s",
+	    dir, DisplayString(dpy)) >= (int)sizeof addr.sun_path)
+		return;
+	unlink(addr.sun_path);
+	mask = umask(077); /* no window with a world writable socket */
+	if ((statusfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0
+	|| bind(statusfd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+		fprintf(stderr, "dwm: cannot listen on %s: %s\n",
+		        addr.sun_path, strerror(errno));
+		if (statusfd >= 0)
+			close(statusfd);
+		statusfd = -1;
+	} else
+		strcpy(statuspath, addr.sun_path);
+	umask(mask);
+}
+
+void
+setuptrace(void)
+{
+	struct sigaction sa = { .sa_handler = crashtrace, .sa_flags = SA_RESETHAND };
+	const char *dir = runtimedir();
+
+	if (!dir || snprintf(tracepath, sizeof tracepath, "%s/dwm-trace%s.json",
+	    dir, DisplayString(dpy)) >= (int)sizeof tracepath) {
+		tracepath[0] = '\0';
+		return;
+	}
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, NULL);
+	sigaction(SIGABRT, &sa, NULL);
+}
+
 void
 setviewport(void)
 {
@@ -3001,6 +4422,27 @@ seturgent(Client *c, int urg)
 	XFree(h);
 }
 
+void
+setwmhints(Client *c, xcb_get_property_reply_t *r)
+{
+	uint32_t *wmh;
+
+	/* the first eight fields are mandatory, as for XGetWMHints() */
+	if (!r || r->type != XA_WM_HINTS || r->format != 32 || r->value_len < 8)
+		return;
+	wmh = xcb_get_property_value(r);
+	if (c == selmon->sel && wmh[0] & XUrgencyHint) {
+		wmh[0] &= ~XUrgencyHint;
+		xcb_change_property(xcon, XCB_PROP_MODE_REPLACE, c->win,
+                                XA_WM_HINTS, XA_WM_HINTS, 32, r->value_len, wmh);
+	} else
+		c->isurgent = (wmh[0] & XUrgencyHint) ? 1 : 0;
+	if (wmh[0] & InputHint)
+		c->neverfocus = !wmh[1];
+	else
+		c->neverfocus = 0;
+}
+
 void
 shiftclient(const Arg *arg)
 {
@@ -3067,45 +4509,21 @@ showhide(Client *c)
 	}
 }
 
-void
-sigchld(int unused)
-{
-	if (signal(SIGCHLD, sigchld) == SIG_ERR)
-		die("can't install SIGCHLD handler:");
-	while (0 < waitpid(-1, NULL, WNOHANG));
-}
-
 void
 sigdwmblocks(const Arg *arg)
 {
-        static int fd = -1;
-        struct flock fl;
         union sigval sv;
 
         if (!dwmblockssig) return;
-        fl.l_type = F_WRLCK;
-        fl.l_whence = SEEK_SET;
-        fl.l_start = 0;
-        fl.l_len = 0;
-        if (fd == -1) {
-                if ((fd = open(DWMBLOCKSLOCKFILE, O_RDONLY)) == -1)
-                        return;
-                if (fcntl(fd, F_GETLK, &fl) == -1 || fl.l_type == F_UNLCK)
-                        return;
-        } else {
-                if (fcntl(fd, F_GETLK, &fl) == -1) return;
-                if (fl.l_type == F_UNLCK) {
-                        close(fd);
-                        if ((fd = open(DWMBLOCKSLOCKFILE, O_RDONLY)) == -1)
-                                return;
-                        fl.l_type = F_WRLCK;
-                        if (fcntl(fd, F_GETLK, &fl) == -1
-                        || fl.l_type == F_UNLCK)
-                                return;
-                }
-        }
         sv.sival_int = (dwmblockssig << 8) | arg->i;
-        sigqueue(fl.l_pid, SIGRTMIN, sv);
+        /* without a watch on the lock file the pid can't be trusted */
+        if (!blockspid || blocksfd < 0)
+                blockspid = lockholder();
+        if (!blockspid) return;
+        /* dwmblocks may have been restarted behind the watch's back */
+        if (sigqueue(blockspid, SIGRTMIN, sv) == -1 && errno == ESRCH
+        && (blockspid = lockholder()))
+                sigqueue(blockspid, SIGRTMIN, sv);
 }
 
 void
@@ -3114,6 +4532,7 @@ spawn(const Arg *arg)
 	if (arg->v == dmenucmd) dmenumon[0] = '0' + selmon->num;
 	if (fork() == 0) {
 		if (dpy) close(ConnectionNumber(dpy));
+		sigprocmask(SIG_SETMASK, &origmask, NULL);
 		setsid();
 		execvp(((char **)arg->v)[0], (char **)arg->v);
 		fprintf(stderr, "dwm: execvp %s", ((char **)arg->v)[0]);
@@ -3132,16 +4551,22 @@ swallow(Client *p, Client *c)
 
 	detach(c);
 	detachstack(c);
+	discardpid(c);
 
 	setclientstate(c, WithdrawnState);
 	XUnmapWindow(dpy, p->win);
 
 	p->swallowing = c;
+	p->unmapped = c->unmapped; /* p shows c's window from now on */
+	c->unmapped = 0;
 	c->mon = p->mon;
+	unindexterm(p);
 
 	Window w = p->win;
 	p->win = c->win;
 	c->win = w;
+	indexwin(p->win, p, 0);
+	indexwin(c->win, p, 1);
 	updatetitle(p);
 	XMoveResizeWindow(dpy, p->win, p->x, p->y, p->w, p->h);
 	arrange(p->mon);
@@ -3152,17 +4577,11 @@ swallow(Client *p, Client *c)
 Client *
 swallowingclient(Window w)
 {
-	Client *c;
-	Monitor *m;
-
-	for (m = mons; m; m = m->next) {
-		for (c = m->clients; c; c = c->next) {
-			if (c->swallowing && c->swallowing->win == w)
-				return c;
-		}
-	}
+	WinSlot *s;
 
-	return NULL;
+	if (!wins || !(s = winslot(w))->c || !s->swallowed)
+		return NULL;
+	return s->c;
 }
 
 void
@@ -3193,23 +4612,80 @@ tagview(const Arg *arg)
 	}
 }
 
+unsigned long long
+tally(Stat *s, unsigned long long start)
+{
+	unsigned long long end = clockns(), ns = end - start;
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(s->hist) - 1 && ns >> (i + 1); i++);
+	s->calls++;
+	s->ns += ns;
+	s->hist[i]++;
+	return end;
+}
+
 Client *
 termforwin(const Client *w)
 {
 	Client *c;
 	Monitor *m;
-
-	if (!w->pid || w->isterminal) return NULL;
-
-	for (m = mons; m; m = m->next) {
-		for (c = m->clients; c; c = c->next) {
-			if (c->isterminal && !c->swallowing
-                        && c->pid && isdescprocess(c->pid, w->pid))
-				return c;
+	Ancestry *a, *walk[32];
+	TermSlot *t;
+	unsigned long long start;
+	pid_t p, ppid, term = 0;
+	unsigned int i, n = 0;
+
+	if (!w->pid || w->isterminal || !terms) return NULL;
+
+	/* walk up once and stop at the closest terminal, or at an ancestor
+	 * whose terminal is known from an earlier walk */
+	for (p = w->pid; p && n < LENGTH(walk); p = ppid) {
+		if (termslot(p)->n) {
+			term = p;
+			break;
 		}
+		ppid = getparentprocess(p, &start);
+		a = &ancestry[pidhash(p) % LENGTH(ancestry)];
+		if (a->pid == p && a->start == start && a->ppid == ppid
+		&& termslot(a->term)->n) {
+			term = a->term;
+			break;
+		}
+		a->pid = p;
+		a->start = start;
+		a->ppid = ppid;
+		a->term = 0;
+		walk[n++] = a;
 	}
-
-	return NULL;
+	for (i = 0; i < n; i++)
+		walk[i]->term = term;
+	if (!term) return NULL;
+
+	/* only when the remembered terminal of a process with several went
+	 * away */
+	t = termslot(term);
+	for (m = mons; m && !t->c; m = m->next)
+		for (c = m->clients; c && !t->c; c = c->next)
+			if (c->isterminal && !c->swallowing && c->pid == term)
+				t->c = c;
+	return t->c;
+}
+
+/* returns the slot holding pid, or the one it would be stored in */
+TermSlot *
+termslot(pid_t pid)
+{
+	unsigned int i, mask = termssize - 1;
+	TermSlot *removed = NULL;
+
+	for (i = pidhash(pid) & mask; terms[i].pid; i = (i + 1) & mask) {
+		if (terms[i].pid == pid && terms[i].n)
+			return &terms[i];
+		if (!terms[i].n && !removed)
+			removed = &terms[i];
+	}
+	return removed ? removed : &terms[i];
 }
 
 void
@@ -3224,6 +4700,7 @@ tile(Monitor *m)
 	Client *c;
 
 	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	PROBE2(tile, m->num, n);
 	if (n == 0) return;
 
 	sx = mx = m->wx + ov;
@@ -3334,9 +4811,8 @@ togglefloating(const Arg *arg)
 		selmon->sel->sfh = selmon->sel->h;
         }
 
-	Atom target = XInternAtom(dpy, "_IS_FLOATING", 0);
 	unsigned int floating[1] = {selmon->sel->isfloating};
-        XChangeProperty(dpy, selmon->sel->win, target,
+        XChangeProperty(dpy, selmon->sel->win, floatingatom,
                         XA_CARDINAL, 32, PropModeReplace,
                         (unsigned char *)floating, 1);
         floatpos(arg);
@@ -3471,6 +4947,17 @@ toggleview(const Arg *arg)
 	updatecurrentdesktop();
 }
 
+void
+trace(char ph, unsigned int kind, unsigned long win, unsigned long long ts)
+{
+	TraceEvent *e = &tracebuf[tracehead++ & (TRACELENGTH - 1)];
+
+	e->ts = ts;
+	e->win = win;
+	e->kind = kind;
+	e->ph = ph;
+}
+
 void
 unfocus(Client *c, int setfocus)
 {
@@ -3483,28 +4970,74 @@ unfocus(Client *c, int setfocus)
 	}
 }
 
+void
+unindexproc(pid_t pid)
+{
+	ProcSlot *s;
+
+	if (!procs)
+		return;
+	/* its children keep pointing here, getparentprocess() notices */
+	if ((s = procslot(pid))->pid == pid && s->ppid >= 0)
+		s->ppid = -1;
+}
+
+void
+unindexterm(Client *c)
+{
+	TermSlot *s;
+
+	if (terms && (s = termslot(c->pid))->n) {
+		s->n--;
+		if (s->c == c)
+			s->c = NULL;
+	}
+}
+
+void
+unindexwin(Window w)
+{
+	WinSlot *s;
+
+	if (wins && (s = winslot(w))->c)
+		s->c = NULL;
+}
+
 void
 unmanage(Client *c, int destroyed)
 {
 	Monitor *m = c->mon;
 	XWindowChanges wc;
+	unsigned long long t = clockns();
 
+	PROBE2(unmanage, c->win, destroyed);
 	if (c->swallowing) {
 		unswallow(c);
+		tally(&stats[StatUnmanage], t);
 		return;
 	}
 
 	Client *s = swallowingclient(c->win);
 	if (s) {
+		/* the terminal itself is gone and was uncounted when it
+		 * swallowed, s is only the swallowed window from now on */
+		s->isterminal = 0;
+		unindexwin(c->win);
 		free(s->swallowing);
 		s->swallowing = NULL;
 		arrange(m);
 		focus(NULL);
+		tally(&stats[StatUnmanage], t);
 		return;
 	}
 
 	detach(c);
 	detachstack(c);
+	unindexwin(c->win);
+	if (c->pidquery)
+		discardpid(c);
+	else if (c->isterminal && c->pid)
+		unindexterm(c);
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
@@ -3512,7 +5045,7 @@ unmanage(Client *c, int destroyed)
 		XConfigureWindow(dpy, c->win, CWBorderWidth, &wc); /* restore border */
 		XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
 		setclientstate(c, WithdrawnState);
-		XSync(dpy, 0);
+		xsync();
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
@@ -3522,6 +5055,7 @@ unmanage(Client *c, int destroyed)
 		focus(NULL);
 		updateclientlist();
 	}
+	tally(&stats[StatUnmanage], t);
 }
 
 void
@@ -3539,16 +5073,21 @@ unmapnotify(XEvent *e)
 void
 unswallow(Client *c)
 {
+	unindexwin(c->win);
 	c->win = c->swallowing->win;
+	indexwin(c->win, c, 0);
+	clientlistdirty = 1;
 
 	free(c->swallowing);
 	c->swallowing = NULL;
+	if (c->isterminal && c->pid)
+		indexterm(c);
 
 	/* unfullscreen the client */
 	setfullscreen(c, 0);
 	updatetitle(c);
 	arrange(c->mon);
-	XMapWindow(dpy, c->win);
+	mapclient(c);
 	XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
 	setclientstate(c, NormalState);
 	focus(NULL);
@@ -3571,6 +5110,8 @@ updatebars(void)
                                 m->ww - 2 * sp, bh, 0, DefaultDepth(dpy, screen),
 				CopyFromParent, DefaultVisual(dpy, screen),
 				CWOverrideRedirect|CWBackPixmap|CWEventMask, &wa);
+		m->drw = drw_create(dpy, screen, root, m->ww, bh);
+		drw_setfontset(m->drw, drw->fonts);
 		XDefineCursor(dpy, m->barwin, cursor[CurNormal]->cursor);
 		XMapRaised(dpy, m->barwin);
 		XSetClassHint(dpy, m->barwin, &ch);
@@ -3596,20 +5137,48 @@ updateclientlist()
 {
 	Client *c;
 	Monitor *m;
+	unsigned int i, n = 0, changed;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	if (!clientlistdirty)
+		return;
+	clientlistdirty = 0;
 	for (m = mons; m; m = m->next)
 		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+			n++;
+	if (n > clientlistsize) {
+		clientlistsize = 2 * n;
+		free(clientlist);
+		free(clientstack);
+		clientlist = ecalloc(clientlistsize, sizeof(Window));
+		clientstack = ecalloc(clientlistsize, sizeof(Window));
+	}
 
-	XDeleteProperty(dpy, root, netatom[NetClientListStacking]);
-	for (m = mons; m; m = m->next)
-		for (c = m->stack; c; c = c->snext)
-			XChangeProperty(dpy, root,
-                                netatom[NetClientListStacking], XA_WINDOW, 32,
-                                PropModeAppend, (unsigned char *) &(c->win), 1);
+	/* rebuild both lists in place and only publish the ones that
+	 * changed, each with a single request */
+	changed = n != nclientlist;
+	for (i = 0, m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next, i++)
+			if (clientlist[i] != c->win) {
+				clientlist[i] = c->win;
+				changed = 1;
+			}
+	if (changed)
+		XChangeProperty(dpy, root, netatom[NetClientList],
+                        XA_WINDOW, 32, PropModeReplace,
+                        (unsigned char *)clientlist, n);
+
+	changed = n != nclientlist;
+	for (i = 0, m = mons; m; m = m->next)
+		for (c = m->stack; c; c = c->snext, i++)
+			if (clientstack[i] != c->win) {
+				clientstack[i] = c->win;
+				changed = 1;
+			}
+	if (changed)
+		XChangeProperty(dpy, root, netatom[NetClientListStacking],
+                        XA_WINDOW, 32, PropModeReplace,
+                        (unsigned char *)clientstack, n);
+	nclientlist = n;
 }
 
 void updatecurrentdesktop(void)
@@ -3626,30 +5195,20 @@ void updatecurrentdesktop(void)
 void
 updatedwmblockssig(int x)
 {
-        char *sts = stexts;
-        char *stp = stexts;
-        char tmp;
-
-        while (*sts != '\0') {
-                if ((unsigned char)*sts >= ' ') {
-                        sts++;
-                        continue;
+        unsigned int i, j;
+
+        for (i = 0; i < nblocks && (x += blocks[i].w) <= 0; i++);
+        /* the signal is the delimiter ending the run of blocks clicked */
+        for (j = i; j < nblocks
+        && !BETWEEN((unsigned char)blocks[j].end, 1, DELIMITERENDCHAR); j++);
+        if (j < nblocks && blocks[j].end != DELIMITERENDCHAR) {
+                if (!selmon->statushandcursor) {
+                        selmon->statushandcursor = 1;
+                        XDefineCursor(dpy, selmon->barwin,
+                                cursor[CurHand]->cursor);
                 }
-                tmp = *sts;
-                *sts = '\0';
-                x += TTEXTW(stp);
-                *sts = tmp;
-                if (x > 0) {
-                        if (tmp == DELIMITERENDCHAR) break;
-                        if (!selmon->statushandcursor) {
-                                selmon->statushandcursor = 1;
-                                XDefineCursor(dpy, selmon->barwin,
-                                        cursor[CurHand]->cursor);
-                        }
-                        dwmblockssig = tmp;
-                        return;
-                }
-                stp = ++sts;
+                dwmblockssig = blocks[j].end;
+                return;
         }
         if (selmon->statushandcursor) {
                 selmon->statushandcursor = 0;
@@ -3658,6 +5217,46 @@ updatedwmblockssig(int x)
         dwmblockssig = 0;
 }
 
+/* bar frames follow the fastest monitor unless barfps says otherwise */
+void
+updateframerate(void)
+{
+	unsigned long long hz = barfps > 0 ? barfps : 0;
+#ifdef XRANDR
+	XRRScreenResources *res;
+	XRRCrtcInfo *crtc;
+	XRRModeInfo *mode;
+	unsigned long long lines;
+	int i, j, major, minor;
+
+	if (!barfps && XRRQueryExtension(dpy, &i, &j)
+	&& XRRQueryVersion(dpy, &major, &minor)
+	&& (major > 1 || minor >= 3)
+	&& (res = XRRGetScreenResourcesCurrent(dpy, root))) {
+		for (i = 0; i < res->ncrtc; i++) {
+			if (!(crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[i])))
+				continue;
+			for (j = 0; j < res->nmode; j++) {
+				mode = &res->modes[j];
+				if (crtc->mode == None || mode->id != crtc->mode)
+					continue;
+				lines = mode->vTotal;
+				if (mode->modeFlags & RR_DoubleScan)
+					lines *= 2;
+				if (mode->modeFlags & RR_Interlace)
+					lines /= 2;
+				if (mode->hTotal && lines)
+					hz = MAX(hz, (mode->dotClock + mode->hTotal * lines / 2)
+					             / (mode->hTotal * lines));
+			}
+			XRRFreeCrtcInfo(crtc);
+		}
+		XRRFreeScreenResources(res);
+	}
+#endif /* XRANDR */
+	frameperiod = 1000000000ULL / (hz ? hz : 60);
+}
+
 int
 updategeom(void)
 {
@@ -3738,35 +5337,10 @@ updategeom(void)
 void
 updatemotifhints(Client *c)
 {
-	Atom real;
-	int format;
-	unsigned char *p = NULL;
-	unsigned long n, extra;
-	unsigned long *motif;
-	int width, height;
+	xcb_get_property_reply_t *r = getprop(c->win, motifatom);
 
-	if (!decorhints) return;
-
-	if (XGetWindowProperty(dpy, c->win, motifatom, 0L, 5L, 0, motifatom,
-	                &real, &format, &n, &extra, &p)
-        == Success && p != NULL) {
-		motif = (unsigned long*)p;
-		if (motif[MWM_HINTS_FLAGS_FIELD] & MWM_HINTS_DECORATIONS) {
-			width = WIDTH(c);
-			height = HEIGHT(c);
-
-			if (motif[MWM_HINTS_DECORATIONS_FIELD] & MWM_DECOR_ALL
-                        || motif[MWM_HINTS_DECORATIONS_FIELD] & MWM_DECOR_BORDER
-                        || motif[MWM_HINTS_DECORATIONS_FIELD] & MWM_DECOR_TITLE)
-				c->bw = c->oldbw = borderpx;
-			else
-				c->bw = c->oldbw = 0;
-
-			resize( c, c->x, c->y,
-                                width - (2*c->bw), height - (2*c->bw), 0);
-		}
-		XFree(p);
-	}
+	setmotifhints(c, r);
+	free(r);
 }
 
 void
@@ -3788,46 +5362,10 @@ updatenumlockmask(void)
 void
 updatesizehints(Client *c)
 {
-	long msize;
-	XSizeHints size;
+	xcb_get_property_reply_t *r = getprop(c->win, XA_WM_NORMAL_HINTS);
 
-	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
-		/* size is uninitialized, ensure that size.flags aren't used */
-		size.flags = PSize;
-	if (size.flags & PBaseSize) {
-		c->basew = size.base_width;
-		c->baseh = size.base_height;
-	} else if (size.flags & PMinSize) {
-		c->basew = size.min_width;
-		c->baseh = size.min_height;
-	} else
-		c->basew = c->baseh = 0;
-	if (size.flags & PResizeInc) {
-		c->incw = size.width_inc;
-		c->inch = size.height_inc;
-	} else
-		c->incw = c->inch = 0;
-	if (size.flags & PMaxSize) {
-		c->maxw = size.max_width;
-		c->maxh = size.max_height;
-	} else
-		c->maxw = c->maxh = 0;
-	if (size.flags & PMinSize) {
-		c->minw = size.min_width;
-		c->minh = size.min_height;
-	} else if (size.flags & PBaseSize) {
-		c->minw = size.base_width;
-		c->minh = size.base_height;
-	} else
-		c->minw = c->minh = 0;
-	if (size.flags & PAspect) {
-		c->mina = (float)size.min_aspect.y / size.min_aspect.x;
-		c->maxa = (float)size.max_aspect.x / size.max_aspect.y;
-	} else
-		c->maxa = c->mina = 0.0;
-	c->isfixed = (c->maxw && c->maxh
-                        && c->maxw == c->minw
-                        && c->maxh == c->minh);
+	setsizehints(c, r);
+	free(r);
 }
 
 void
@@ -3835,53 +5373,37 @@ updatestatus(void)
 {
 	char rawstext[STATUSLENGTH];
 
-	if (gettextprop(root, XA_WM_NAME, rawstext, sizeof rawstext)) {
-                char stextp[STATUSLENGTH];
-                char *stp = stextp, *stc = stextc, *sts = stexts;
-
-                for (char *rst = rawstext; *rst != '\0'; rst++)
-                        if ((unsigned char)*rst >= ' ')
-                                *(stp++) = *(stc++) = *(sts++) = *rst;
-                        else if ((unsigned char)*rst > DELIMITERENDCHAR)
-                                *(stc++) = *rst;
-                        else
-                                *(sts++) = *rst;
-                *stp = *stc = *sts = '\0';
-                wstext = TTEXTW(stextp) + LSPAD + RSPAD;
-        } else {
-                strcpy(stextc, "dwm-"VERSION);
-                strcpy(stexts, stextc);
-                wstext = TTEXTW(stextc) + LSPAD + RSPAD;
-        }
-        drawbar(selmon);
+	if (slotstatus) /* producers use the status socket instead */
+		return;
+	if (!gettextprop(root, XA_WM_NAME, rawstext, sizeof rawstext))
+		strcpy(rawstext, "dwm-"VERSION);
+	setstatus(rawstext);
 }
 
 void
 updatetitle(Client *c)
 {
-	if (!gettextprop(c->win, netatom[NetWMName], c->name, sizeof c->name))
-		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
-	if (c->name[0] == '\0') /* hack to mark broken clients */
-		strcpy(c->name, broken);
+	xcb_get_property_cookie_t netname, name;
+	xcb_get_property_reply_t *rnetname, *rname;
+
+	netname = xcb_get_property(xcon, 0, c->win, netatom[NetWMName],
+                        XCB_GET_PROPERTY_TYPE_ANY, 0, PROPLENGTH);
+	name = xcb_get_property(xcon, 0, c->win, XA_WM_NAME,
+                        XCB_GET_PROPERTY_TYPE_ANY, 0, PROPLENGTH);
+	rnetname = propreply(netname);
+	rname = propreply(name);
+	settitle(c, rnetname, rname);
+	free(rnetname);
+	free(rname);
 }
 
 void
 updatewmhints(Client *c)
 {
-	XWMHints *wmh;
+	xcb_get_property_reply_t *r = getprop(c->win, XA_WM_HINTS);
 
-	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
-		else
-			c->neverfocus = 0;
-		XFree(wmh);
-	}
+	setwmhints(c, r);
+	free(r);
 }
 
 void
@@ -3932,19 +5454,49 @@ view(const Arg *arg)
 	updatecurrentdesktop();
 }
 
+/* hold a bar back when it was already painted in the current frame, the
+ * frame timer paints it once the frame is over */
+int
+waitframe(Monitor *m)
+{
+	struct itimerspec it = { 0 };
+	unsigned long long frame, period = frameperiod;
+
+	if (barfd < 0)
+		return 0;
+	if (m->dirty & DirtyFrame) {
+		suppressed++;
+		return 1;
+	}
+	frame = clockns() / period;
+	if (m->frame != frame) {
+		m->frame = frame;
+		return 0;
+	}
+	m->dirty |= DirtyFrame;
+	if (armedframe != frame + 1) {
+		armedframe = frame + 1;
+		it.it_value.tv_sec = armedframe * period / 1000000000ULL;
+		it.it_value.tv_nsec = armedframe * period % 1000000000ULL;
+		timerfd_settime(barfd, TFD_TIMER_ABSTIME, &it, NULL);
+	}
+	return 1;
+}
+
+void
+watchfd(int fd, unsigned int id)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.u32 = id };
+
+	if (fd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		die("epoll_ctl:");
+}
+
 pid_t
-winpid(Window w)
+winpid(xcb_res_query_client_ids_reply_t *r)
 {
 	pid_t result = 0;
-	xcb_res_client_id_spec_t spec = {0};
-	spec.client = w;
-	spec.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID;
-
-	xcb_generic_error_t *e = NULL;
-	xcb_res_query_client_ids_cookie_t c = xcb_res_query_client_ids(
-                                                        xcon, 1, &spec);
-	xcb_res_query_client_ids_reply_t *r = xcb_res_query_client_ids_reply(
-                                                        xcon, c, &e);
+	xcb_res_client_id_spec_t spec;
 
 	if (!r) return (pid_t)0;
 
@@ -3959,24 +5511,40 @@ winpid(Window w)
 		}
 	}
 
-	free(r);
-
 	if (result == (pid_t)-1) result = 0;
 
 	return result;
 }
 
+/* returns the slot holding w, or the one it would be stored in */
+WinSlot *
+winslot(Window w)
+{
+	unsigned long h = w;
+	unsigned int i, mask = winssize - 1;
+	WinSlot *removed = NULL;
+
+	/* ids of different X clients differ in the high bits only */
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	for (i = h & mask; wins[i].win != None; i = (i + 1) & mask) {
+		if (wins[i].win == w && wins[i].c)
+			return &wins[i];
+		if (!wins[i].c && !removed)
+			removed = &wins[i];
+	}
+	return removed ? removed : &wins[i];
+}
+
 Client *
 wintoclient(Window w)
 {
-	Client *c;
-	Monitor *m;
+	WinSlot *s;
 
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w)
-				return c;
-	return NULL;
+	if (!wins || !(s = winslot(w))->c || s->swallowed)
+		return NULL;
+	return s->c;
 }
 
 Monitor *
@@ -3996,6 +5564,59 @@ wintomon(Window w)
 	return selmon;
 }
 
+/* write the flight recorder as Chrome trace events, which Perfetto and
+ * chrome://tracing load. Also called from crashtrace(), so only
+ * async-signal-safe calls are allowed */
+void
+writetrace(void)
+{
+	static const char *names[] = {
+		[TraceArrange - LASTEvent] = "arrange",
+		[TraceDrawbar - LASTEvent] = "drawbar",
+		[TraceSync - LASTEvent] = "XSync",
+	};
+	char buf[256], *p;
+	const char *name;
+	unsigned long i = tracehead > TRACELENGTH ? tracehead - TRACELENGTH : 0;
+	TraceEvent *e;
+	int fd;
+
+	if (!tracepath[0] || (fd = open(tracepath,
+	    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+		return;
+	p = buf;
+	p = putstr(p, "{\"traceEvents\":[");
+	for (; i < tracehead; i++) {
+		e = &tracebuf[i & (TRACELENGTH - 1)];
+		name = e->kind >= LASTEvent ? names[e->kind - LASTEvent]
+		       : evnames[e->kind] ? evnames[e->kind] : "XEvent";
+		p = putstr(p, "\n{\"name\":\"");
+		p = putstr(p, name);
+		p = putstr(p, "\",\"ph\":\"");
+		*p++ = e->ph;
+		p = putstr(p, "\",\"pid\":1,\"tid\":1,\"ts\":");
+		p = putnum(p, e->ts / 1000, 10);
+		*p++ = '.';
+		*p++ = '0' + e->ts % 1000 / 100;
+		*p++ = '0' + e->ts % 100 / 10;
+		*p++ = '0' + e->ts % 10;
+		if (e->win) {
+			p = putstr(p, ",\"args\":{\"win\":\"0x");
+			p = putnum(p, e->win, 16);
+			p = putstr(p, "\"}");
+		}
+		*p++ = '}';
+		if (i + 1 < tracehead)
+			*p++ = ',';
+		if (write(fd, buf, p - buf) < 0)
+			break;
+		p = buf;
+	}
+	p = putstr(p, "]}\n");
+	write(fd, buf, p - buf);
+	close(fd);
+}
+
 /* There's no way to check accesses to destroyed windows, thus those cases are
  * ignored (especially on UnmapNotify's). Other types of errors call Xlibs
  * default error handler, which may call exit. */
@@ -4033,6 +5654,14 @@ xerrorstart(Display *dpy, XErrorEvent *ee)
 	return -1;
 }
 
+void
+xsync(void)
+{
+	trace('B', TraceSync, 0, clockns());
+	XSync(dpy, False);
+	trace('E', TraceSync, 0, clockns());
+}
+
 void
 zoom(const Arg *arg)
 {
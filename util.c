@@ -33,3 +33,13 @@ die(const char *fmt, ...) {
 
 	exit(1);
 }
+
+unsigned int
+fnv1a(unsigned int h, const void *data, size_t n)
+{
+	const unsigned char *p = data;
+
+	while (n--)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
@@ -4,5 +4,22 @@
 #define MIN(A, B)               ((A) < (B) ? (A) : (B))
 #define BETWEEN(X, A, B)        ((A) <= (X) && (X) <= (B))
 
+#define FNV1A_INIT              2166136261u
+
+/* USDT probes for bpftrace and friends, gone without <sys/sdt.h> */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#endif
+#endif
+#ifdef DTRACE_PROBE
+#define PROBE2(N, A, B)             DTRACE_PROBE2(dwm, N, A, B)
+#define PROBE5(N, A, B, C, D, E)    DTRACE_PROBE5(dwm, N, A, B, C, D, E)
+#else
+#define PROBE2(N, A, B)
+#define PROBE5(N, A, B, C, D, E)
+#endif
+
 void die(const char *fmt, ...);
 void *ecalloc(size_t nmemb, size_t size);
+unsigned int fnv1a(unsigned int h, const void *data, size_t n);